@@ -0,0 +1,165 @@
+#pragma once
+
+#include <juce_data_structures/juce_data_structures.h>
+
+#include <gsl/span>
+
+#include "identifiers.h"
+
+namespace genki {
+
+//======================================================================================================================
+// Advertisement fields of a device, encoded as AD structures ([length][type][payload]) like the advertising packet
+// itself. UUIDs and company identifiers are little-endian, all UUIDs are in their 128-bit form. The record is stored on
+// BLUETOOTH_DEVICE as a MemoryBlock under ID::advertisement, this class is a non-owning view of it.
+class AdvertisementData
+{
+public:
+    enum Type : uint8_t
+    {
+        ServiceUuids         = 0x07, // Complete list of 128-bit service UUIDs
+        TxPowerLevel         = 0x0A, // int8_t dBm
+        ServiceData          = 0x21, // 128-bit UUID followed by the data
+        ManufacturerSpecific = 0xFF, // Company identifier followed by the data
+    };
+
+    AdvertisementData() = default;
+
+    explicit AdvertisementData(gsl::span<const gsl::byte> advertisementRecord) : record(advertisementRecord) {}
+
+    // Only valid while the property stays unchanged
+    static AdvertisementData fromDevice(const juce::ValueTree& device)
+    {
+        if (const auto* block = device.getProperty(ID::advertisement).getBinaryData())
+            return AdvertisementData(gsl::span(static_cast<const gsl::byte*>(block->getData()), block->getSize()));
+
+        return {};
+    }
+
+    [[nodiscard]] gsl::span<const gsl::byte> getRecord() const { return record; }
+
+    //==================================================================================================================
+    // Calls fn(uint8_t type, gsl::span<const gsl::byte> payload) for every AD structure in the record
+    template<typename Fn>
+    void forEach(Fn&& fn) const
+    {
+        for (size_t pos = 0; pos < record.size();)
+        {
+            const auto length = static_cast<size_t>(record[pos]);
+
+            if (length == 0 || pos + 1 + length > record.size())
+                break;
+
+            fn(static_cast<uint8_t>(record[pos + 1]), record.subspan(pos + 2, length - 1));
+
+            pos += 1 + length;
+        }
+    }
+
+    [[nodiscard]] std::optional<int8_t> getTxPower() const
+    {
+        std::optional<int8_t> tx_power;
+
+        forEach([&](uint8_t type, auto payload)
+                {
+                    if (type == TxPowerLevel && payload.size() == 1)
+                        tx_power = static_cast<int8_t>(payload[0]);
+                });
+
+        return tx_power;
+    }
+
+    // Empty if the device doesn't advertise data for the company
+    [[nodiscard]] gsl::span<const gsl::byte> getManufacturerData(uint16_t companyId) const
+    {
+        gsl::span<const gsl::byte> data;
+
+        forEach([&](uint8_t type, auto payload)
+                {
+                    if (type == ManufacturerSpecific && payload.size() >= 2
+                        && (static_cast<uint16_t>(payload[0]) | static_cast<uint16_t>(static_cast<uint16_t>(payload[1]) << 8)) == companyId)
+                        data = payload.subspan(2);
+                });
+
+        return data;
+    }
+
+    [[nodiscard]] gsl::span<const gsl::byte> getServiceData(const juce::Uuid& uuid) const
+    {
+        const auto                 uuid_bytes = toLittleEndian(uuid);
+        gsl::span<const gsl::byte> data;
+
+        forEach([&](uint8_t type, auto payload)
+                {
+                    if (type == ServiceData && payload.size() >= 16 && std::equal(uuid_bytes.begin(), uuid_bytes.end(), payload.begin()))
+                        data = payload.subspan(16);
+                });
+
+        return data;
+    }
+
+    [[nodiscard]] bool hasServiceUuid(const juce::Uuid& uuid) const
+    {
+        const auto uuid_bytes = toLittleEndian(uuid);
+        bool       found      = false;
+
+        forEach([&](uint8_t type, auto payload)
+                {
+                    for (size_t i = 0; type == ServiceUuids && i + 16 <= payload.size(); i += 16)
+                        found = found || std::equal(uuid_bytes.begin(), uuid_bytes.end(), payload.begin() + static_cast<ptrdiff_t>(i));
+                });
+
+        return found;
+    }
+
+    //==================================================================================================================
+    // Writing side. Appends one AD structure made of the given parts, cut off at the 254 bytes a structure can carry.
+    static void append(std::vector<gsl::byte>& rec, uint8_t type, std::initializer_list<gsl::span<const gsl::byte>> parts)
+    {
+        const auto start = rec.size();
+
+        rec.push_back(gsl::byte{0});
+        rec.push_back(static_cast<gsl::byte>(type));
+
+        for (const auto& part: parts)
+            rec.insert(rec.end(), part.begin(), part.begin() + static_cast<ptrdiff_t>(std::min(part.size(), start + 256 - rec.size())));
+
+        rec[start] = static_cast<gsl::byte>(rec.size() - start - 1);
+    }
+
+    // Parses "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx" into little-endian bytes without going through juce::String
+    static bool parseUuid(std::string_view str, gsl::span<gsl::byte, 16> out)
+    {
+        size_t num_digits = 0;
+
+        for (const char c: str)
+        {
+            if (c == '-')
+                continue;
+
+            const int digit = juce::CharacterFunctions::getHexDigitValue(static_cast<juce::juce_wchar>(c));
+
+            if (digit < 0 || num_digits == 32)
+                return false;
+
+            auto& byte = out[15 - num_digits / 2];
+            byte       = num_digits % 2 == 0 ? static_cast<gsl::byte>(digit << 4) : byte | static_cast<gsl::byte>(digit);
+
+            ++num_digits;
+        }
+
+        return num_digits == 32;
+    }
+
+    static std::array<gsl::byte, 16> toLittleEndian(const juce::Uuid& uuid)
+    {
+        std::array<gsl::byte, 16> bytes{};
+        std::reverse_copy(uuid.getRawData(), uuid.getRawData() + 16, reinterpret_cast<uint8_t*>(bytes.data()));
+        return bytes;
+    }
+
+private:
+    gsl::span<const gsl::byte> record;
+};
+
+} // namespace genki
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <juce_data_structures/juce_data_structures.h>
+
+#include "identifiers.h"
+
+namespace genki {
+
+//======================================================================================================================
+// Rate limits the rssi/name/advertisement/last_seen updates that advertisements cause on known devices. Each device
+// publishes at most once per interval, advertisements received in between are coalesced and published with their
+// latest values when the interval is over. With a policy set, last_seen is only published once half of the adapter's
+// ID::device_timeout has passed since the published value, which is all the expiry needs.
+class AdvertisementThrottle : private juce::ValueTree::Listener, private juce::Timer
+{
+public:
+    struct Policy
+    {
+        int minIntervalMs = 0; // Minimum time between two updates of the same device
+        int minRssiDelta  = 0; // RSSI changes smaller than this are not published, the name only when it changes
+    };
+
+    explicit AdvertisementThrottle(juce::ValueTree adapterState)
+        : state(std::move(adapterState))
+    {
+        for (const auto& device: state)
+            add(device);
+
+        state.addListener(this);
+    }
+
+    ~AdvertisementThrottle() override
+    {
+        stopTimer();
+        state.removeListener(this);
+    }
+
+    // Publishes whatever is still held back under the old policy
+    void setPolicy(Policy newPolicy)
+    {
+        for (const auto& address: pending)
+            if (const auto it = entries.find(address); it != entries.end() && it->second.pending)
+                publish(it->second);
+
+        pending.clear();
+        stopTimer();
+
+        policy = newPolicy;
+    }
+
+    [[nodiscard]] Policy getPolicy() const { return policy; }
+
+    void deviceSeen(const juce::ValueTree& device, const juce::String& address, int rssi, const juce::String& name, int now)
+    {
+        auto& entry = entries[address];
+
+        entry.device     = device;
+        entry.rssi       = rssi;
+        entry.lastSeen   = now;
+        entry.lastUpdate = now;
+
+        if (name.isNotEmpty())
+            entry.name = name;
+
+        update(entry, address);
+    }
+
+    // The record is set on the device as ID::advertisement, see AdvertisementData
+    void advertisementChanged(const juce::ValueTree& device, const juce::String& address, juce::MemoryBlock record, int now)
+    {
+        auto& entry = entries[address];
+
+        entry.device        = device;
+        entry.advertisement = std::move(record);
+        entry.lastUpdate    = now;
+
+        update(entry, address);
+    }
+
+    //==================================================================================================================
+    static Policy getPolicy(const juce::ValueTree& scanMessage)
+    {
+        return {scanMessage.getProperty(ID::min_update_interval, 0), scanMessage.getProperty(ID::min_rssi_delta, 0)};
+    }
+
+    static void setPolicy(juce::ValueTree& scanMessage, Policy policy)
+    {
+        scanMessage.setProperty(ID::min_update_interval, policy.minIntervalMs, nullptr);
+        scanMessage.setProperty(ID::min_rssi_delta, policy.minRssiDelta, nullptr);
+    }
+
+private:
+    struct Entry
+    {
+        juce::ValueTree                  device;
+        int                              rssi          = 0;
+        juce::String                     name;
+        std::optional<juce::MemoryBlock> advertisement;
+        int                              lastSeen      = 0;
+        int                              lastUpdate    = 0;
+        int                              lastPublished = 0;
+        bool                             pending       = false;
+    };
+
+    void update(Entry& entry, const juce::String& address)
+    {
+        if (entry.lastUpdate - entry.lastPublished >= policy.minIntervalMs)
+        {
+            publish(entry);
+        }
+        else if (!entry.pending)
+        {
+            entry.pending = true;
+            pending.push_back(address);
+
+            if (!isTimerRunning())
+                startTimer(std::max(policy.minIntervalMs, 1));
+        }
+    }
+
+    void publish(Entry& entry)
+    {
+        if (std::abs(entry.rssi - static_cast<int>(entry.device.getProperty(ID::rssi))) >= policy.minRssiDelta)
+            entry.device.setProperty(ID::rssi, entry.rssi, nullptr);
+
+        if (entry.name.isNotEmpty() && entry.name != entry.device.getProperty(ID::name).toString())
+            entry.device.setProperty(ID::name, entry.name, nullptr);
+
+        if (entry.advertisement.has_value())
+        {
+            if (const auto* current = entry.device.getProperty(ID::advertisement).getBinaryData(); current == nullptr || *current != *entry.advertisement)
+                entry.device.setProperty(ID::advertisement, std::move(*entry.advertisement), nullptr);
+
+            entry.advertisement.reset();
+        }
+
+        if (isLastSeenDue(entry))
+            entry.device.setProperty(ID::last_seen, entry.lastSeen, nullptr);
+
+        entry.lastPublished = entry.lastUpdate;
+        entry.pending       = false;
+    }
+
+    [[nodiscard]] bool isLastSeenDue(const Entry& entry) const
+    {
+        if (policy.minIntervalMs <= 0 && policy.minRssiDelta <= 0)
+            return true;
+
+        const int timeout = state.getProperty(ID::device_timeout, 0);
+        return entry.lastSeen - static_cast<int>(entry.device.getProperty(ID::last_seen)) >= timeout / 2;
+    }
+
+    void timerCallback() override
+    {
+        const auto now = static_cast<int>(juce::Time::getMillisecondCounter());
+
+        pending.erase(std::remove_if(pending.begin(), pending.end(), [&](const juce::String& address)
+                                     {
+                                         const auto it = entries.find(address);
+
+                                         // Removed, or removed and added again, in the meantime
+                                         if (it == entries.end() || !it->second.pending)
+                                             return true;
+
+                                         if (now - it->second.lastPublished < policy.minIntervalMs)
+                                             return false;
+
+                                         publish(it->second);
+                                         return true;
+                                     }),
+                      pending.end());
+
+        if (pending.empty())
+            stopTimer();
+    }
+
+    void add(const juce::ValueTree& device)
+    {
+        if (device.hasType(ID::BLUETOOTH_DEVICE))
+        {
+            const int last_seen = device.getProperty(ID::last_seen);
+            entries[device.getProperty(ID::address).toString()] = {device, device.getProperty(ID::rssi), device.getProperty(ID::name).toString(), std::nullopt, last_seen, last_seen, last_seen};
+        }
+    }
+
+    void valueTreeChildAdded(juce::ValueTree& parent, juce::ValueTree& child) override
+    {
+        if (parent == state)
+            add(child);
+    }
+
+    void valueTreeChildRemoved(juce::ValueTree& parent, juce::ValueTree& child, int) override
+    {
+        if (parent == state && child.hasType(ID::BLUETOOTH_DEVICE))
+            if (const auto it = entries.find(child.getProperty(ID::address).toString()); it != entries.end() && it->second.device == child)
+                entries.erase(it);
+    }
+
+    //==================================================================================================================
+    juce::ValueTree state;
+    Policy          policy;
+
+    std::unordered_map<juce::String, Entry> entries;
+    std::vector<juce::String>               pending;
+};
+
+} // namespace genki
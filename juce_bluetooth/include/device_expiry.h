@@ -0,0 +1,147 @@
+#pragma once
+
+#include <juce_data_structures/juce_data_structures.h>
+
+#include "identifiers.h"
+
+namespace genki {
+
+//======================================================================================================================
+// Min-heap of device deadlines keyed on last_seen. Deadlines are refreshed lazily: a device that has been seen again
+// since it was queued is pushed back with its new deadline once it comes up, so each tick only touches due devices.
+// Only the latest entry of a device counts, the ones it replaced are swept out once they make up half of the heap.
+// The Windows backend adds devices from WinRT threads, so the heap is guarded by a lock. The timeout is published on
+// the adapter state as ID::device_timeout.
+class DeviceExpiry : private juce::ValueTree::Listener
+{
+public:
+    DeviceExpiry(juce::ValueTree adapterState, int timeout)
+        : state(std::move(adapterState)),
+          timeoutMs(timeout)
+    {
+        state.setProperty(ID::device_timeout, timeoutMs, nullptr);
+        state.addListener(this);
+    }
+
+    ~DeviceExpiry() override { state.removeListener(this); }
+
+    [[nodiscard]] int getTimeout() const { return timeoutMs; }
+
+    void setTimeout(int ms)
+    {
+        state.setProperty(ID::device_timeout, ms, nullptr);
+
+        const juce::ScopedLock lock(mutex);
+
+        timeoutMs = ms;
+
+        // Queued deadlines were based on the old timeout
+        heap.clear();
+        generations.clear();
+
+        for (const auto& device: state)
+            if (device.hasType(ID::BLUETOOTH_DEVICE))
+                schedule(device);
+    }
+
+    void removeExpired(int now)
+    {
+        std::vector<juce::ValueTree> expired;
+
+        {
+            const juce::ScopedLock lock(mutex);
+
+            while (!heap.empty() && now - heap.front().deadline > 0)
+            {
+                std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+
+                const auto entry = std::move(heap.back());
+                heap.pop_back();
+
+                if (!isLatest(entry))
+                    continue;
+
+                generations.erase(entry.address);
+
+                // Removed in the meantime, or queued again when it disconnects
+                if (entry.device.getParent() != state || entry.device.getProperty(ID::is_connected))
+                    continue;
+
+                if (const int last_seen = entry.device.getProperty(ID::last_seen); now - last_seen > timeoutMs)
+                    expired.push_back(entry.device);
+                else
+                    schedule(entry.device);
+            }
+        }
+
+        // Listeners of the state don't run under the lock
+        for (const auto& device: expired)
+            state.removeChild(device, nullptr);
+    }
+
+private:
+    struct Entry
+    {
+        int             deadline;
+        uint32_t        generation;
+        juce::String    address;
+        juce::ValueTree device;
+
+        bool operator>(const Entry& other) const { return deadline - other.deadline > 0; }
+    };
+
+    [[nodiscard]] bool isLatest(const Entry& entry) const
+    {
+        const auto it = generations.find(entry.address);
+        return it != generations.end() && it->second == entry.generation;
+    }
+
+    // Called with the lock held
+    void schedule(const juce::ValueTree& device)
+    {
+        const auto generation = ++lastGeneration;
+        auto       address    = device.getProperty(ID::address).toString();
+
+        generations[address] = generation;
+
+        heap.push_back({static_cast<int>(device.getProperty(ID::last_seen)) + timeoutMs, generation, std::move(address), device});
+        std::push_heap(heap.begin(), heap.end(), std::greater<>());
+
+        // Every is_connected change queues the device again, the replaced entries would otherwise pile up
+        if (heap.size() > 2 * generations.size())
+        {
+            heap.erase(std::remove_if(heap.begin(), heap.end(), [this](const Entry& e) { return !isLatest(e); }), heap.end());
+            std::make_heap(heap.begin(), heap.end(), std::greater<>());
+        }
+    }
+
+    void valueTreeChildAdded(juce::ValueTree& parent, juce::ValueTree& child) override
+    {
+        if (parent == state && child.hasType(ID::BLUETOOTH_DEVICE))
+        {
+            const juce::ScopedLock lock(mutex);
+            schedule(child);
+        }
+    }
+
+    void valueTreePropertyChanged(juce::ValueTree& vt, const juce::Identifier& id) override
+    {
+        if (id == ID::is_connected && vt.getParent() == state && !vt.getProperty(id))
+        {
+            const juce::ScopedLock lock(mutex);
+            schedule(vt);
+        }
+    }
+
+    //==================================================================================================================
+    juce::ValueTree state;
+    int             timeoutMs;
+
+    juce::CriticalSection mutex;
+
+    std::vector<Entry>                         heap;
+    std::unordered_map<juce::String, uint32_t> generations;
+    uint32_t                                   lastGeneration = 0;
+};
+
+} // namespace genki
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <juce_data_structures/juce_data_structures.h>
+
+#include "identifiers.h"
+
+namespace genki {
+
+//======================================================================================================================
+// Address to BLUETOOTH_DEVICE lookup for the adapter state, kept in sync as devices are added and removed. The Windows
+// backend adds and removes devices from WinRT threads, so the map is guarded by a lock.
+class DeviceIndex : private juce::ValueTree::Listener
+{
+public:
+    explicit DeviceIndex(juce::ValueTree adapterState)
+        : state(std::move(adapterState))
+    {
+        for (const auto& device: state)
+            add(device);
+
+        state.addListener(this);
+    }
+
+    ~DeviceIndex() override { state.removeListener(this); }
+
+    [[nodiscard]] juce::ValueTree find(const juce::String& address) const
+    {
+        const juce::ScopedLock lock(mutex);
+
+        const auto it = devices.find(address);
+        return it != devices.end() ? it->second : juce::ValueTree{};
+    }
+
+private:
+    void add(const juce::ValueTree& device)
+    {
+        if (device.hasType(ID::BLUETOOTH_DEVICE))
+        {
+            const juce::ScopedLock lock(mutex);
+            devices[device.getProperty(ID::address).toString()] = device;
+        }
+    }
+
+    void valueTreeChildAdded(juce::ValueTree& parent, juce::ValueTree& child) override
+    {
+        if (parent == state)
+            add(child);
+    }
+
+    void valueTreeChildRemoved(juce::ValueTree& parent, juce::ValueTree& child, int) override
+    {
+        if (parent == state && child.hasType(ID::BLUETOOTH_DEVICE))
+        {
+            const juce::ScopedLock lock(mutex);
+
+            if (const auto it = devices.find(child.getProperty(ID::address).toString()); it != devices.end() && it->second == child)
+                devices.erase(it);
+        }
+    }
+
+    //==================================================================================================================
+    juce::ValueTree state;
+
+    juce::CriticalSection                             mutex;
+    std::unordered_map<juce::String, juce::ValueTree> devices;
+};
+
+} // namespace genki
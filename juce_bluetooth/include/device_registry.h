@@ -0,0 +1,263 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+namespace genki {
+
+//======================================================================================================================
+// Flat registry of scanned devices for compact scanning, one slot per device across contiguous arrays keyed by the
+// 48-bit MAC address. Devices only get a BLUETOOTH_DEVICE node once promoted, after which their updates go to the
+// node. Filled by the Bluetooth thread, everything is guarded by one lock.
+//
+// Expiry uses a min-heap on last seen like DeviceExpiry, refreshed lazily so that updates don't touch it and each tick
+// only looks at due devices. Promoted devices leave the heap and are queued again when demoted.
+class DeviceRegistry
+{
+public:
+    struct Device
+    {
+        uint64_t          address;
+        juce::String      name;
+        int16_t           rssi;
+        int               lastSeen;
+        bool              isPromoted;
+        juce::MemoryBlock advertisement; // Empty until one was kept, see keepAdvertisement()
+    };
+
+    // Returns true if the device is promoted, promote marks it as such
+    bool update(uint64_t address, const char* name, int16_t rssi, int now, bool promote = false)
+    {
+        const juce::ScopedLock lock(mutex);
+
+        auto [it, inserted] = slots.try_emplace(address, static_cast<uint32_t>(addresses.size()));
+        const auto slot     = it->second;
+
+        if (inserted)
+        {
+            addresses.push_back(address);
+            names.emplace_back();
+            advertisements.emplace_back();
+            rssis.push_back(rssi);
+            lastSeens.push_back(now);
+            promoted.push_back(promote);
+            generations.push_back(0);
+
+            schedule(slot);
+        }
+
+        if (name != nullptr && *name != 0 && names[slot] != name)
+            names[slot] = juce::String::fromUTF8(name);
+
+        rssis[slot]     = rssi;
+        lastSeens[slot] = now;
+        promoted[slot]  = promoted[slot] || promote;
+
+        return promoted[slot];
+    }
+
+    // Keeps the advertisement record of a device that isn't promoted, in place. Returns false if the device is promoted
+    // or not in the registry, in which case the record belongs on its node.
+    bool keepAdvertisement(uint64_t address, const void* data, size_t size)
+    {
+        const juce::ScopedLock lock(mutex);
+
+        const auto it = slots.find(address);
+
+        if (it == slots.end() || promoted[it->second])
+            return false;
+
+        if (auto& record = advertisements[it->second]; !record.matches(data, size))
+            record.replaceAll(data, size);
+
+        return true;
+    }
+
+    std::optional<Device> find(uint64_t address) const
+    {
+        const juce::ScopedLock lock(mutex);
+
+        if (const auto it = slots.find(address); it != slots.end())
+            return get(it->second);
+
+        return std::nullopt;
+    }
+
+    // Marks the device as promoted and returns it, nullopt if it isn't in the registry
+    std::optional<Device> promote(uint64_t address)
+    {
+        const juce::ScopedLock lock(mutex);
+
+        if (const auto it = slots.find(address); it != slots.end())
+        {
+            promoted[it->second] = true;
+            return get(it->second);
+        }
+
+        return std::nullopt;
+    }
+
+    // The device's node is gone, it's tracked here again until it expires
+    void demote(uint64_t address)
+    {
+        const juce::ScopedLock lock(mutex);
+
+        if (const auto it = slots.find(address); it != slots.end() && promoted[it->second])
+        {
+            promoted[it->second] = false;
+            schedule(it->second);
+        }
+    }
+
+    // Calls fn(const Device&) for every device, under the lock
+    template<typename Fn>
+    void forEach(Fn&& fn) const
+    {
+        const juce::ScopedLock lock(mutex);
+
+        for (uint32_t slot = 0; slot < addresses.size(); ++slot)
+            fn(get(slot));
+    }
+
+    [[nodiscard]] size_t size() const
+    {
+        const juce::ScopedLock lock(mutex);
+        return addresses.size();
+    }
+
+    // Promoted devices are left to the node's own expiry
+    void removeExpired(int now, int timeoutMs)
+    {
+        const juce::ScopedLock lock(mutex);
+
+        while (!heap.empty() && now - heap.front().lastSeen > timeoutMs)
+        {
+            std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+
+            const auto entry = heap.back();
+            heap.pop_back();
+
+            const auto it = slots.find(entry.address);
+
+            if (it == slots.end() || generations[it->second] != entry.generation || promoted[it->second])
+                continue;
+
+            if (const auto slot = it->second; now - lastSeens[slot] > timeoutMs)
+                remove(slot);
+            else
+                schedule(slot);
+        }
+    }
+
+    //==================================================================================================================
+    // "aa:bb:cc:dd:ee:ff" in any case or separator, 0 if it can't be parsed
+    static uint64_t toKey(std::string_view address)
+    {
+        uint64_t key        = 0;
+        int      num_digits = 0;
+
+        for (const char c: address)
+        {
+            if (const int digit = juce::CharacterFunctions::getHexDigitValue(static_cast<juce::juce_wchar>(c)); digit >= 0)
+            {
+                key = (key << 4) | static_cast<uint64_t>(digit);
+                ++num_digits;
+            }
+        }
+
+        return num_digits == 12 ? key : 0;
+    }
+
+    static uint64_t toKey(const juce::String& address) { return toKey(std::string_view(address.toRawUTF8())); }
+
+    // Formatted like the address property of BLUETOOTH_DEVICE
+    static juce::String toAddressString(uint64_t key)
+    {
+        uint8_t bytes[6];
+
+        for (int i = 0; i < 6; ++i)
+            bytes[i] = static_cast<uint8_t>(key >> (8 * (5 - i)));
+
+        return juce::MACAddress(bytes).toString();
+    }
+
+private:
+    struct Entry
+    {
+        int      lastSeen;
+        uint32_t generation;
+        uint64_t address;
+
+        bool operator>(const Entry& other) const { return lastSeen - other.lastSeen > 0; }
+    };
+
+    // Called with the lock held, only the latest entry of a slot counts
+    void schedule(uint32_t slot)
+    {
+        generations[slot] = ++lastGeneration;
+
+        heap.push_back({lastSeens[slot], generations[slot], addresses[slot]});
+        std::push_heap(heap.begin(), heap.end(), std::greater<>());
+
+        // Demoting queues the device again while an older entry may still be waiting
+        if (heap.size() > 2 * addresses.size())
+        {
+            heap.erase(std::remove_if(heap.begin(), heap.end(), [this](const Entry& e) { return !isLatest(e); }), heap.end());
+            std::make_heap(heap.begin(), heap.end(), std::greater<>());
+        }
+    }
+
+    [[nodiscard]] bool isLatest(const Entry& entry) const
+    {
+        const auto it = slots.find(entry.address);
+        return it != slots.end() && generations[it->second] == entry.generation;
+    }
+
+    Device get(uint32_t slot) const { return {addresses[slot], names[slot], rssis[slot], lastSeens[slot], promoted[slot] != 0, advertisements[slot]}; }
+
+    // Moves the last slot into the hole so that the arrays stay contiguous
+    void remove(uint32_t slot)
+    {
+        const auto last = static_cast<uint32_t>(addresses.size() - 1);
+
+        slots.erase(addresses[slot]);
+
+        if (slot != last)
+        {
+            addresses[slot]      = addresses[last];
+            names[slot]          = std::move(names[last]);
+            advertisements[slot] = std::move(advertisements[last]);
+            rssis[slot]          = rssis[last];
+            lastSeens[slot]      = lastSeens[last];
+            promoted[slot]       = promoted[last];
+            generations[slot]    = generations[last];
+
+            slots[addresses[slot]] = slot;
+        }
+
+        addresses.pop_back();
+        names.pop_back();
+        advertisements.pop_back();
+        rssis.pop_back();
+        lastSeens.pop_back();
+        promoted.pop_back();
+        generations.pop_back();
+    }
+
+    //==================================================================================================================
+    juce::CriticalSection mutex;
+
+    std::unordered_map<uint64_t, uint32_t> slots;
+
+    std::vector<uint64_t>          addresses;
+    std::vector<juce::String>      names;
+    std::vector<juce::MemoryBlock> advertisements;
+    std::vector<int16_t>           rssis;
+    std::vector<int>               lastSeens;
+    std::vector<uint8_t>           promoted;
+    std::vector<uint32_t>          generations;
+
+    std::vector<Entry> heap;
+    uint32_t           lastGeneration = 0;
+};
+
+} // namespace genki
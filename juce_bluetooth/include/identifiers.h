@@ -7,6 +7,8 @@ namespace ID {
 
 DECLARE_ID(BLUETOOTH_ADAPTER)
 DECLARE_ID(status)
+DECLARE_ID(is_discovering) // Adapter's Discovering property, true while any BlueZ client scans (Linux only)
+DECLARE_ID(device_timeout) // See BleAdapter::setDeviceTimeout()
 
 DECLARE_ID(BLUETOOTH_DEVICE)
 DECLARE_ID(name)
@@ -16,6 +18,7 @@ DECLARE_ID(max_value_length)
 DECLARE_ID(rssi)
 DECLARE_ID(last_seen)
 DECLARE_ID(max_pdu_size)
+DECLARE_ID(advertisement) // MemoryBlock, see AdvertisementData
 
 DECLARE_ID(SERVICE)
 DECLARE_ID(uuid)
@@ -26,10 +29,19 @@ DECLARE_ID(CHARACTERISTIC)
 //DECLARE_ID(uuid)
 DECLARE_ID(can_write_with_response)
 DECLARE_ID(can_write_without_response)
-DECLARE_ID(properties)
+DECLARE_ID(properties) // Bitmask of CharacteristicProperty
 DECLARE_ID(handle)
 DECLARE_ID(value_handle)
 
+DECLARE_ID(DESCRIPTOR)
+//DECLARE_ID(uuid)
+DECLARE_ID(value) // MemoryBlock, last value read from the descriptor
+
+DECLARE_ID(KNOWN_DEVICES) // See KnownDevices
+DECLARE_ID(KNOWN_DEVICE)
+DECLARE_ID(address_type)
+DECLARE_ID(last_connected)
+
 DECLARE_ID(SCAN)
 DECLARE_ID(should_start)
 
@@ -38,14 +50,35 @@ DECLARE_ID(CONNECT)
 DECLARE_ID(DISCOVER_SERVICES)
 DECLARE_ID(SERVICES_DISCOVERED)
 DECLARE_ID(DISCOVER_CHARACTERISTICS)
+DECLARE_ID(DISCOVER_ALL)
+DECLARE_ID(ALL_DISCOVERED)
 DECLARE_ID(ENABLE_NOTIFICATIONS)
 DECLARE_ID(ENABLE_INDICATIONS)
 DECLARE_ID(NOTIFICATIONS_ARE_ENABLED)
+DECLARE_ID(READ_DESCRIPTOR)
+DECLARE_ID(WRITE_DESCRIPTOR) // The value to write as ID::value
+
+// Message options
+DECLARE_ID(acquire) // ENABLE_NOTIFICATIONS: deliver notifications through a dedicated socket (Linux only)
+DECLARE_ID(min_update_interval) // SCAN: see AdvertisementThrottle::Policy
+DECLARE_ID(min_rssi_delta)      // SCAN: see AdvertisementThrottle::Policy
 
 #undef DECLARE_ID
 
 } // namespace ID
 
+// Bits of ID::properties, as in the characteristic declaration
+namespace CharacteristicProperty {
+constexpr int Broadcast                 = 0x01;
+constexpr int Read                      = 0x02;
+constexpr int WriteWithoutResponse      = 0x04;
+constexpr int Write                     = 0x08;
+constexpr int Notify                    = 0x10;
+constexpr int Indicate                  = 0x20;
+constexpr int AuthenticatedSignedWrites = 0x40;
+constexpr int ExtendedProperties        = 0x80;
+} // namespace CharacteristicProperty
+
 enum class AdapterStatus
 {
     Disabled,
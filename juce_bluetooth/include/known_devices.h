@@ -0,0 +1,173 @@
+#pragma once
+
+#include <juce_data_structures/juce_data_structures.h>
+
+#include "device_registry.h"
+#include "identifiers.h"
+
+namespace genki {
+
+//======================================================================================================================
+// Devices we have connected to before, kept in a file across runs so that they can be connected again without
+// scanning. Updated by the Bluetooth thread on every connection, everything is guarded by one lock. The file is only
+// written by flush(), which BleAdapter calls from the message thread, so connecting never waits for the disk.
+class KnownDevices
+{
+public:
+    ~KnownDevices() { flush(); }
+
+    struct Device
+    {
+        juce::String      address;
+        juce::String      name;
+        juce::String      addressType; // "public" or "random", as BlueZ reports it
+        juce::StringArray services;    // Service UUIDs as of the last connection
+        juce::int64       lastConnected = 0;
+    };
+
+    // Loads the devices stored in the file, which is rewritten whenever a device is forgotten or, by flush(),
+    // remembered. Pass juce::File() to stop storing them.
+    void setFile(const juce::File& newFile)
+    {
+        const juce::ScopedLock lock(mutex);
+
+        file = newFile;
+        devices.clear();
+        isDirty = false;
+
+        if (file == juce::File())
+            return;
+
+        juce::FileInputStream in(file);
+
+        if (!in.openedOk())
+            return;
+
+        for (const auto& vt: juce::ValueTree::readFromStream(in))
+        {
+            if (!vt.hasType(ID::KNOWN_DEVICE))
+                continue;
+
+            Device device{vt.getProperty(ID::address).toString(), vt.getProperty(ID::name).toString(), vt.getProperty(ID::address_type).toString(), {}, vt.getProperty(ID::last_connected)};
+
+            for (const auto& service: vt)
+                device.services.add(service.getProperty(ID::uuid).toString());
+
+            devices.push_back(std::move(device));
+        }
+    }
+
+    [[nodiscard]] std::optional<Device> find(const juce::String& address) const
+    {
+        const juce::ScopedLock lock(mutex);
+
+        if (const auto it = findDevice(address); it != devices.end())
+            return *it;
+
+        return std::nullopt;
+    }
+
+    // The file is written by the next flush()
+    void remember(Device device)
+    {
+        const juce::ScopedLock lock(mutex);
+
+        if (auto it = findDevice(device.address); it != devices.end())
+        {
+            // Keeps what BlueZ didn't report this time
+            if (device.name.isEmpty())
+                device.name = it->name;
+
+            if (device.addressType.isEmpty())
+                device.addressType = it->addressType;
+
+            *it = std::move(device);
+        }
+        else
+        {
+            devices.push_back(std::move(device));
+        }
+
+        isDirty = true;
+    }
+
+    // Returns false if the file couldn't be written
+    bool forget(const juce::String& address)
+    {
+        const juce::ScopedLock lock(mutex);
+
+        if (const auto it = findDevice(address); it != devices.end())
+        {
+            devices.erase(it);
+            isDirty = false;
+
+            return save();
+        }
+
+        return true;
+    }
+
+    // Writes the file if a device was remembered since it was last written. Returns false if it couldn't be written,
+    // it isn't tried again until the next change.
+    bool flush()
+    {
+        const juce::ScopedLock lock(mutex);
+
+        return !std::exchange(isDirty, false) || save();
+    }
+
+    // Calls fn(const Device&) for every device, under the lock
+    template<typename Fn>
+    void forEach(Fn&& fn) const
+    {
+        const juce::ScopedLock lock(mutex);
+
+        for (const auto& device: devices)
+            fn(device);
+    }
+
+private:
+    std::vector<Device>::const_iterator findDevice(const juce::String& address) const
+    {
+        const auto key = DeviceRegistry::toKey(address);
+        return std::find_if(devices.begin(), devices.end(), [&](const auto& d) { return DeviceRegistry::toKey(d.address) == key; });
+    }
+
+    std::vector<Device>::iterator findDevice(const juce::String& address)
+    {
+        const auto key = DeviceRegistry::toKey(address);
+        return std::find_if(devices.begin(), devices.end(), [&](const auto& d) { return DeviceRegistry::toKey(d.address) == key; });
+    }
+
+    bool save() const
+    {
+        if (file == juce::File())
+            return true;
+
+        juce::ValueTree vt{ID::KNOWN_DEVICES};
+
+        for (const auto& device: devices)
+        {
+            juce::ValueTree dev{ID::KNOWN_DEVICE, {{ID::address, device.address}, {ID::name, device.name}, {ID::address_type, device.addressType}, {ID::last_connected, device.lastConnected}}};
+
+            for (const auto& uuid: device.services)
+                dev.appendChild({ID::SERVICE, {{ID::uuid, uuid}}}, nullptr);
+
+            vt.appendChild(dev, nullptr);
+        }
+
+        juce::MemoryOutputStream out;
+        vt.writeToStream(out);
+
+        return file.getParentDirectory().createDirectory() && file.replaceWithData(out.getData(), out.getDataSize());
+    }
+
+    //==================================================================================================================
+    juce::CriticalSection mutex;
+
+    juce::File          file;
+    std::vector<Device> devices;
+    bool                isDirty = false;
+};
+
+} // namespace genki
@@ -1,14 +1,19 @@
 #pragma once
 
+#include "identifiers.h"
 #include "juce_bluetooth_log.h"
 #include "org-bluez-Adapter1.h"
 #include "org-bluez-Device1.h"
 #include "org-bluez-GattCharacteristic1.h"
+#include "org-bluez-GattDescriptor1.h"
+#include <gio/gunixfdlist.h>
 #include <glib.h>
 #include <juce_core/juce_core.h>
+#include <optional>
 
 using DeviceProxy         = std::unique_ptr<OrgBluezDevice1, decltype(&g_object_unref)>;
 using CharacteristicProxy = std::unique_ptr<OrgBluezGattCharacteristic1, decltype(&g_object_unref)>;
+using DescriptorProxy     = std::unique_ptr<OrgBluezGattDescriptor1, decltype(&g_object_unref)>;
 
 namespace genki::bluez_utils {
 
@@ -66,4 +71,142 @@ inline auto get_device_for_address(const OrgBluezAdapter1* adapter, juce::String
     return get_device_from_object_path(object_path);
 }
 
+// Typed proxy of a device from the object manager, created once when BlueZ exported the device. nullptr if the object
+// manager doesn't know the device.
+inline auto get_device_proxy(GDBusObjectManager* manager, const OrgBluezAdapter1* adapter, juce::StringRef device_address) -> DeviceProxy
+{
+    const auto object_path = get_device_object_path_from_address(adapter, device_address);
+
+    return DeviceProxy(reinterpret_cast<OrgBluezDevice1*>(g_dbus_object_manager_get_interface(manager, object_path.toRawUTF8(), "org.bluez.Device1")), g_object_unref);
+}
+
+// Proxy types for the object manager, so that the proxies it creates can be used with the generated API
+inline auto get_proxy_type(GDBusObjectManagerClient*, const gchar*, const gchar* interface_name, gpointer) -> GType
+{
+    if (interface_name == nullptr)
+        return G_TYPE_DBUS_OBJECT_PROXY;
+
+    if (strcmp(interface_name, "org.bluez.Device1") == 0)
+        return ORG_BLUEZ_TYPE_DEVICE1_PROXY;
+
+    if (strcmp(interface_name, "org.bluez.GattCharacteristic1") == 0)
+        return ORG_BLUEZ_TYPE_GATT_CHARACTERISTIC1_PROXY;
+
+    if (strcmp(interface_name, "org.bluez.GattDescriptor1") == 0)
+        return ORG_BLUEZ_TYPE_GATT_DESCRIPTOR1_PROXY;
+
+    return G_TYPE_DBUS_PROXY;
+}
+
+// Typed proxy of a GATT object, proxy_new_sync being the generated org_bluez_*_proxy_new_sync
+template<typename Proxy, typename ProxyNewSync>
+inline auto get_gatt_proxy(GDBusObjectManager* manager, juce::StringRef object_path, ProxyNewSync proxy_new_sync) -> std::unique_ptr<Proxy, decltype(&g_object_unref)>
+{
+    GError* error      = nullptr;
+    gchar*  name_owner = g_dbus_object_manager_client_get_name_owner(G_DBUS_OBJECT_MANAGER_CLIENT(manager));
+
+    // Note: Binding to the unique name of bluetoothd and skipping the property fetch means constructing the proxy
+    //       doesn't need a round-trip to the bus. Property changes are delivered through the object manager.
+    Proxy* proxy = proxy_new_sync(
+            g_dbus_object_manager_client_get_connection(G_DBUS_OBJECT_MANAGER_CLIENT(manager)),
+            static_cast<GDBusProxyFlags>(G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES | G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS),
+            name_owner != nullptr ? name_owner : "org.bluez",
+            object_path.text,
+            nullptr,
+            &error);
+
+    g_free(name_owner);
+
+    if (error != nullptr)
+    {
+        LOG(fmt::format("Bluetooth - Failed to get D-Bus proxy for {}: {}", object_path.text, error->message));
+        g_error_free(error);
+
+        return {nullptr, g_object_unref};
+    }
+
+    return {proxy, g_object_unref};
+}
+
+inline auto get_characteristic_proxy(GDBusObjectManager* manager, juce::StringRef object_path) -> CharacteristicProxy
+{
+    return get_gatt_proxy<OrgBluezGattCharacteristic1>(manager, object_path, org_bluez_gatt_characteristic1_proxy_new_sync);
+}
+
+inline auto get_descriptor_proxy(GDBusObjectManager* manager, juce::StringRef object_path) -> DescriptorProxy
+{
+    return get_gatt_proxy<OrgBluezGattDescriptor1>(manager, object_path, org_bluez_gatt_descriptor1_proxy_new_sync);
+}
+
+// UUID of an object exported by BlueZ, if it implements the interface
+inline auto get_object_uuid(GDBusObjectManager* manager, const char* object_path, const char* interface_name) -> std::optional<juce::Uuid>
+{
+    std::optional<juce::Uuid> uuid;
+
+    if (GDBusInterface* interface = g_dbus_object_manager_get_interface(manager, object_path, interface_name))
+    {
+        if (GVariant* uuid_variant = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(interface), "UUID"))
+        {
+            uuid = juce::Uuid(juce::String(g_variant_get_string(uuid_variant, nullptr)));
+            g_variant_unref(uuid_variant);
+        }
+
+        g_object_unref(interface);
+    }
+
+    return uuid;
+}
+
+// GattCharacteristic1.Flags as CharacteristicProperty bits
+inline auto get_characteristic_properties(GDBusProxy* characteristic) -> int
+{
+    static constexpr std::pair<const char*, int> flag_bits[] = {
+            {"broadcast", CharacteristicProperty::Broadcast},
+            {"read", CharacteristicProperty::Read},
+            {"write-without-response", CharacteristicProperty::WriteWithoutResponse},
+            {"write", CharacteristicProperty::Write},
+            {"notify", CharacteristicProperty::Notify},
+            {"indicate", CharacteristicProperty::Indicate},
+            {"authenticated-signed-writes", CharacteristicProperty::AuthenticatedSignedWrites},
+            {"extended-properties", CharacteristicProperty::ExtendedProperties},
+    };
+
+    int properties = 0;
+
+    if (GVariant* flags = g_dbus_proxy_get_cached_property(characteristic, "Flags"))
+    {
+        GVariantIter iter;
+        const gchar* flag = nullptr;
+
+        g_variant_iter_init(&iter, flags);
+
+        while (g_variant_iter_next(&iter, "&s", &flag))
+            for (const auto& [name, bit]: flag_bits)
+                if (strcmp(flag, name) == 0)
+                    properties |= bit;
+
+        g_variant_unref(flags);
+    }
+
+    return properties;
+}
+
+inline auto get_fd_from_list(GUnixFDList* fd_list, gint fd_index) -> int
+{
+    GError* error = nullptr;
+
+    // Note: Returns a duplicate of the descriptor, the caller owns it
+    const int fd = g_unix_fd_list_get(fd_list, fd_index, &error);
+
+    if (error != nullptr)
+    {
+        LOG(fmt::format("Bluetooth - Failed to get file descriptor: {}", error->message));
+        g_error_free(error);
+
+        return -1;
+    }
+
+    return fd;
+}
+
 } // namespace genki::bluez_utils
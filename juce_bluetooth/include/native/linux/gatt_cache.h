@@ -0,0 +1,263 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <juce_data_structures/juce_data_structures.h>
+
+#include "identifiers.h"
+
+namespace ID {
+// D-Bus object path of SERVICE, CHARACTERISTIC and DESCRIPTOR nodes
+const juce::Identifier dbus_object_path("dbus_object_path");
+}
+
+namespace genki {
+
+//======================================================================================================================
+// GATT database of a device as BlueZ exposes it, with the subscriptions made on it and the device's Database Hash.
+// Services and characteristics are kept sorted by object path, so the checksum doesn't depend on discovery order.
+struct GattDatabase
+{
+    // Database Hash characteristic (GATT 5.1), which the device changes whenever its database changes
+    static juce::Uuid getDatabaseHashUuid() { return juce::Uuid("00002b2a-0000-1000-8000-00805f9b34fb"); }
+
+    struct Characteristic
+    {
+        std::string path;
+        juce::Uuid  uuid;
+        bool        notify  = false;
+        bool        acquire = false;
+    };
+
+    struct Service
+    {
+        std::string                 path;
+        juce::Uuid                  uuid;
+        std::vector<Characteristic> characteristics;
+    };
+
+    void addService(std::string_view path, const juce::Uuid& uuid)
+    {
+        const auto it = std::lower_bound(services.begin(), services.end(), path, [](const auto& s, auto p) { return s.path < p; });
+
+        if (it == services.end() || it->path != path)
+            services.insert(it, Service{std::string(path), uuid, {}});
+        else if (it->uuid.isNull())
+            it->uuid = uuid;
+    }
+
+    // The service is the parent object of the characteristic
+    void addCharacteristic(std::string_view path, const juce::Uuid& uuid)
+    {
+        const auto service_path = path.substr(0, path.rfind('/'));
+
+        addService(service_path, {});
+
+        auto&      chars = findService(service_path)->characteristics;
+        const auto it    = std::lower_bound(chars.begin(), chars.end(), path, [](const auto& c, auto p) { return c.path < p; });
+
+        if (it == chars.end() || it->path != path)
+            chars.insert(it, Characteristic{std::string(path), uuid});
+    }
+
+    Service* findService(std::string_view path)
+    {
+        const auto it = std::find_if(services.begin(), services.end(), [&](const auto& s) { return s.path == path; });
+        return it != services.end() ? &*it : nullptr;
+    }
+
+    Characteristic* findCharacteristic(std::string_view path)
+    {
+        if (auto* service = findService(path.substr(0, path.rfind('/'))))
+            for (auto& c: service->characteristics)
+                if (c.path == path)
+                    return &c;
+
+        return nullptr;
+    }
+
+    // True if the services are the same and so are the characteristics of every service that has any recorded. Only
+    // the services the application looked into have their characteristics recorded. Only needed for devices without a
+    // Database Hash, the hash covers everything else.
+    [[nodiscard]] bool isCompatibleWith(const GattDatabase& current) const
+    {
+        const auto same_layout = [](const auto& a, const auto& b) { return a.path == b.path && a.uuid == b.uuid; };
+
+        return std::equal(services.begin(), services.end(), current.services.begin(), current.services.end(), [&](const auto& s, const auto& cs)
+                          {
+                              return same_layout(s, cs)
+                                     && (s.characteristics.empty()
+                                         || std::equal(s.characteristics.begin(), s.characteristics.end(), cs.characteristics.begin(), cs.characteristics.end(), same_layout));
+                          });
+    }
+
+    // FNV-1a over the Database Hash, paths and UUIDs, only used to detect damaged files. Subscriptions are not part of
+    // the layout.
+    [[nodiscard]] uint64_t checksum() const
+    {
+        uint64_t h = 14695981039346656037ull;
+
+        const auto add = [&](const void* data, size_t size)
+        {
+            for (size_t i = 0; i < size; ++i)
+                h = (h ^ static_cast<const uint8_t*>(data)[i]) * 1099511628211ull;
+        };
+
+        add(databaseHash.getData(), databaseHash.getSize());
+
+        for (const auto& s: services)
+        {
+            add(s.path.data(), s.path.size() + 1);
+            add(s.uuid.getRawData(), 16);
+
+            for (const auto& c: s.characteristics)
+            {
+                add(c.path.data(), c.path.size() + 1);
+                add(c.uuid.getRawData(), 16);
+            }
+        }
+
+        return h;
+    }
+
+    // SERVICE and CHARACTERISTIC nodes under a BLUETOOTH_DEVICE node, as discovery publishes them. Calls
+    // fn(const Characteristic&, const juce::ValueTree& node) for every characteristic.
+    template<typename Fn>
+    [[nodiscard]] juce::ValueTree toValueTree(Fn&& fn) const
+    {
+        juce::ValueTree device{ID::BLUETOOTH_DEVICE};
+
+        for (const auto& s: services)
+        {
+            juce::ValueTree service{ID::SERVICE, {{ID::uuid, s.uuid.toDashedString()}, {ID::dbus_object_path, juce::String(s.path)}}, {}};
+
+            for (const auto& c: s.characteristics)
+            {
+                const juce::ValueTree charact{ID::CHARACTERISTIC, {{ID::uuid, c.uuid.toDashedString()}, {ID::dbus_object_path, juce::String(c.path)}}, {}};
+
+                fn(c, charact);
+                service.appendChild(charact, nullptr);
+            }
+
+            device.appendChild(service, nullptr);
+        }
+
+        return device;
+    }
+
+    std::vector<Service> services;
+
+    // Value of the Database Hash characteristic as of when the database was recorded, empty if the device has none
+    juce::MemoryBlock databaseHash;
+};
+
+//======================================================================================================================
+// One small binary file per device, named after its address. A file that fails to parse or doesn't match its checksum
+// is treated as a miss. Whether the database is still current is up to the Database Hash it carries.
+struct GattCache
+{
+    [[nodiscard]] bool isEnabled() const { return directory != juce::File(); }
+
+    [[nodiscard]] std::optional<GattDatabase> load(const juce::String& address) const
+    {
+        juce::MemoryBlock data;
+
+        if (!isEnabled() || !getFile(address).loadFileAsData(data))
+            return std::nullopt;
+
+        juce::MemoryInputStream in(data, false);
+
+        if (in.readInt() != Magic || in.readInt() != Version)
+            return std::nullopt;
+
+        const auto   checksum = static_cast<uint64_t>(in.readInt64());
+        GattDatabase db;
+
+        in.readIntoMemoryBlock(db.databaseHash, in.readCompressedInt());
+
+        for (int i = 0, num_services = in.readInt(); i < num_services && !in.isExhausted(); ++i)
+        {
+            GattDatabase::Service service;
+            service.uuid = readUuid(in);
+            service.path = in.readString().toStdString();
+
+            for (int j = 0, num_chars = in.readInt(); j < num_chars && !in.isExhausted(); ++j)
+            {
+                GattDatabase::Characteristic charact;
+                charact.uuid = readUuid(in);
+                charact.path = in.readString().toStdString();
+
+                const auto flags = in.readByte();
+                charact.notify   = (flags & NotifyFlag) != 0;
+                charact.acquire  = (flags & AcquireFlag) != 0;
+
+                service.characteristics.push_back(std::move(charact));
+            }
+
+            db.services.push_back(std::move(service));
+        }
+
+        if (db.checksum() != checksum)
+            return std::nullopt;
+
+        return db;
+    }
+
+    bool save(const juce::String& address, const GattDatabase& db) const
+    {
+        if (!isEnabled())
+            return false;
+
+        juce::MemoryOutputStream out;
+
+        out.writeInt(Magic);
+        out.writeInt(Version);
+        out.writeInt64(static_cast<juce::int64>(db.checksum()));
+        out.writeCompressedInt(static_cast<int>(db.databaseHash.getSize()));
+        out << db.databaseHash;
+        out.writeInt(static_cast<int>(db.services.size()));
+
+        for (const auto& s: db.services)
+        {
+            out.write(s.uuid.getRawData(), 16);
+            out.writeString(juce::String(s.path));
+            out.writeInt(static_cast<int>(s.characteristics.size()));
+
+            for (const auto& c: s.characteristics)
+            {
+                out.write(c.uuid.getRawData(), 16);
+                out.writeString(juce::String(c.path));
+                out.writeByte(static_cast<char>((c.notify ? NotifyFlag : 0) | (c.acquire ? AcquireFlag : 0)));
+            }
+        }
+
+        return directory.createDirectory() && getFile(address).replaceWithData(out.getData(), out.getDataSize());
+    }
+
+    void remove(const juce::String& address) const
+    {
+        if (isEnabled())
+            getFile(address).deleteFile();
+    }
+
+    juce::File directory;
+
+private:
+    static constexpr int Magic       = 0x54544147; // "GATT"
+    static constexpr int Version     = 2;
+    static constexpr int NotifyFlag  = 1;
+    static constexpr int AcquireFlag = 2;
+
+    [[nodiscard]] juce::File getFile(const juce::String& address) const
+    {
+        return directory.getChildFile(address.removeCharacters(":-").toLowerCase() + ".gatt");
+    }
+
+    static juce::Uuid readUuid(juce::InputStream& in)
+    {
+        uint8_t raw[16] = {};
+        in.read(raw, 16);
+        return juce::Uuid(raw);
+    }
+};
+
+} // namespace genki
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <glib-unix.h>
+#include <glib.h>
+
+namespace genki {
+
+//======================================================================================================================
+// Unlike g_unix_fd_add(), which always uses the global default context, the watch follows the thread-default context
+inline GSource* add_fd_watch(int fd, GIOCondition condition, GUnixFDSourceFunc func, gpointer user_data)
+{
+    GSource* source = g_unix_fd_source_new(fd, condition);
+
+    g_source_set_callback(source, reinterpret_cast<GSourceFunc>(func), user_data, nullptr);
+    g_source_attach(source, g_main_context_get_thread_default());
+
+    return source;
+}
+
+inline void destroy_source(GSource*& source)
+{
+    if (source != nullptr)
+    {
+        g_source_destroy(source);
+        g_source_unref(source);
+    }
+
+    source = nullptr;
+}
+
+} // namespace genki
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <glib.h>
+#include <juce_core/juce_core.h>
+
+namespace genki {
+
+//======================================================================================================================
+// Thread running a private GMainContext. D-Bus proxies, async calls and fd watches created on it dispatch there.
+struct IoThread : private juce::Thread
+{
+    IoThread()
+        : juce::Thread("Bluetooth I/O"),
+          context(g_main_context_new()),
+          loop(g_main_loop_new(context, false))
+    {
+        startThread(juce::Thread::Priority::high);
+    }
+
+    ~IoThread() override
+    {
+        jassert(!isThreadRunning());
+
+        g_main_loop_unref(loop);
+        g_main_context_unref(context);
+    }
+
+    // The command is moved to the heap as is, without wrapping it in a std::function first
+    template<typename Fn>
+    void invoke(Fn&& fn)
+    {
+        using Command = std::decay_t<Fn>;
+
+        g_main_context_invoke_full(
+                context,
+                G_PRIORITY_DEFAULT,
+                [](gpointer user_data) -> gboolean
+                {
+                    (*static_cast<Command*>(user_data))();
+                    return G_SOURCE_REMOVE;
+                },
+                new Command(std::forward<Fn>(fn)),
+                [](gpointer user_data) { delete static_cast<Command*>(user_data); });
+    }
+
+    // Runs the last function on the thread, then quits the loop and waits for the thread to exit
+    void stop(std::function<void()> fn)
+    {
+        invoke([this, f = std::move(fn)]
+               {
+                   f();
+                   g_main_loop_quit(loop);
+               });
+
+        waitForThreadToExit(-1);
+    }
+
+    void run() override
+    {
+        g_main_context_push_thread_default(context);
+        g_main_loop_run(loop);
+        g_main_context_pop_thread_default(context);
+    }
+
+    GMainContext* context;
+    GMainLoop*    loop;
+};
+
+} // namespace genki
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <string>
+#include <unistd.h>
+
+#include "glib_sources.h"
+#include "notify_socket.h"
+
+namespace genki {
+
+//======================================================================================================================
+// Notifications of one characteristic. They are read from the socket returned by GattCharacteristic1.AcquireNotify,
+// one packet per notification, so values reach the callbacks without going through D-Bus signals. BlueZ hangs up the
+// socket when another client stops notifications or the MTU changes, a new one is acquired then. Characteristics that
+// can't be acquired fall back to StartNotify, their values arrive as PropertiesChanged signals.
+class NotifyChannel
+{
+public:
+    enum class State
+    {
+        Off,
+        Acquiring,      // AcquireNotify in flight
+        Socket,         // Reading notifications from the socket
+        StartingNotify, // StartNotify in flight
+        Signals,        // Notifications arrive as PropertiesChanged signals
+    };
+
+    // Makes the D-Bus calls for the channel and takes the notifications it reads
+    struct Provider
+    {
+        virtual ~Provider() = default;
+
+        // Answered with acquired() or acquireFailed()
+        virtual void acquireNotify(NotifyChannel&) = 0;
+
+        // Answered with started() or startFailed()
+        virtual void startNotify(NotifyChannel&) = 0;
+
+        // One notification read from the socket, may destroy the channel
+        virtual void notificationReceived(NotifyChannel&, gsl::span<const gsl::byte>) = 0;
+
+        // Notifications are flowing, either way. Also called for requests made while they already are.
+        virtual void notificationsEnabled(NotifyChannel&) = 0;
+
+        // Asked when the socket was hung up, false once the device is gone
+        virtual bool shouldReacquire(NotifyChannel&) = 0;
+    };
+
+    NotifyChannel(Provider& p, std::string path)
+        : provider(p),
+          objectPath(std::move(path))
+    {
+    }
+
+    ~NotifyChannel() { closeSocket(); }
+
+    // Requests made while a call is in flight are answered once it completes
+    void enable(bool acquire)
+    {
+        if (isEnabled())
+            provider.notificationsEnabled(*this);
+        else if (state == State::Off)
+            acquire ? acquireSocket() : startNotify();
+    }
+
+    void acquired(int newFd, uint16_t mtu)
+    {
+        if (state != State::Acquiring)
+        {
+            close(newFd);
+            return;
+        }
+
+        fd    = newFd;
+        state = State::Socket;
+
+        buffer.resize(mtu);
+        source = add_fd_watch(fd, static_cast<GIOCondition>(G_IO_IN | G_IO_HUP | G_IO_ERR), &NotifyChannel::onSocketReady, this);
+
+        provider.notificationsEnabled(*this);
+    }
+
+    void acquireFailed()
+    {
+        if (state == State::Acquiring)
+            startNotify();
+    }
+
+    void started()
+    {
+        if (state != State::StartingNotify)
+            return;
+
+        state = State::Signals;
+        provider.notificationsEnabled(*this);
+    }
+
+    void startFailed()
+    {
+        if (state == State::StartingNotify)
+            state = State::Off;
+    }
+
+    [[nodiscard]] State getState() const { return state; }
+
+    [[nodiscard]] bool isEnabled() const { return state == State::Socket || state == State::Signals; }
+
+    [[nodiscard]] const std::string& getObjectPath() const { return objectPath; }
+
+    // Note: The ATT MTU of the socket, the 3 byte ATT header is not part of the notifications read from it
+    [[nodiscard]] size_t getMtu() const { return buffer.size(); }
+
+private:
+    void acquireSocket()
+    {
+        state = State::Acquiring;
+        provider.acquireNotify(*this);
+    }
+
+    void startNotify()
+    {
+        state = State::StartingNotify;
+        provider.startNotify(*this);
+    }
+
+    void hungUp()
+    {
+        closeSocket();
+        state = State::Off;
+
+        if (provider.shouldReacquire(*this))
+            acquireSocket();
+    }
+
+    void closeSocket()
+    {
+        destroy_source(source);
+
+        if (fd >= 0)
+            close(fd);
+
+        fd = -1;
+    }
+
+    static gboolean onSocketReady(gint, GIOCondition condition, gpointer user_data)
+    {
+        auto* c = static_cast<NotifyChannel*>(user_data);
+
+        if ((condition & G_IO_IN) != 0)
+        {
+            // Note: The provider may destroy the channel, don't touch it afterwards
+            const auto status = bluez_utils::read_notification(c->fd, c->buffer, [c](auto data) { c->provider.notificationReceived(*c, data); });
+
+            if (status != bluez_utils::NotifySocketStatus::Closed)
+                return G_SOURCE_CONTINUE;
+        }
+
+        // Note: Destroys this source, a re-acquired socket gets a new one
+        c->hungUp();
+
+        return G_SOURCE_REMOVE;
+    }
+
+    //==================================================================================================================
+    Provider&         provider;
+    const std::string objectPath;
+
+    State                  state  = State::Off;
+    int                    fd     = -1;
+    GSource*               source = nullptr;
+    std::vector<gsl::byte> buffer;
+};
+
+} // namespace genki
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cerrno>
+#include <gsl/span>
+#include <sys/socket.h>
+#include <vector>
+
+namespace genki::bluez_utils {
+
+enum class NotifySocketStatus
+{
+    Delivered,  // One notification was passed on
+    WouldBlock, // Nothing to read right now, wait for the next G_IO_IN
+    Closed,     // BlueZ closed its end (notifications stopped or the link dropped), or the socket failed
+};
+
+//======================================================================================================================
+// Reads one notification from a socket returned by GattCharacteristic1.AcquireNotify and passes it to
+// deliver(gsl::span<const gsl::byte>). The socket is SOCK_SEQPACKET, so every packet is exactly one notification,
+// however short. Only one packet is read per call since deliver() may tear down the owner of the buffer.
+template<typename Deliver>
+NotifySocketStatus read_notification(int fd, std::vector<gsl::byte>& buffer, Deliver&& deliver)
+{
+    const auto len = recv(fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+
+    if (len > 0)
+    {
+        deliver(gsl::span<const gsl::byte>(buffer.data(), static_cast<size_t>(len)));
+        return NotifySocketStatus::Delivered;
+    }
+
+    if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return NotifySocketStatus::WouldBlock;
+
+    return NotifySocketStatus::Closed;
+}
+
+} // namespace genki::bluez_utils
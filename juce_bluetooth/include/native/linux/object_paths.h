@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace genki {
+
+//======================================================================================================================
+// Hash map keyed by D-Bus object path, lookups take a std::string_view so signal handlers don't need to allocate
+struct ObjectPathHash
+{
+    using is_transparent = void;
+
+    size_t operator()(std::string_view path) const noexcept { return std::hash<std::string_view>{}(path); }
+};
+
+template<typename T>
+using ObjectPathMap = std::unordered_map<std::string, T, ObjectPathHash, std::equal_to<>>;
+
+//======================================================================================================================
+// BlueZ object paths by parent path (adapter, device, service, characteristic, descriptor), kept up to date from the
+// object manager signals so that discovery only looks at the subtree of the device at hand
+struct ObjectPathIndex
+{
+    void add(std::string_view path)
+    {
+        const auto parent = path.substr(0, path.rfind('/'));
+
+        auto it = children.find(parent);
+
+        if (it == children.end())
+            it = children.try_emplace(std::string(parent)).first;
+
+        if (std::find(it->second.begin(), it->second.end(), path) == it->second.end())
+            it->second.emplace_back(path);
+    }
+
+    // Removes the whole subtree
+    void remove(std::string_view path)
+    {
+        if (const auto it = children.find(path.substr(0, path.rfind('/'))); it != children.end())
+            it->second.erase(std::remove(it->second.begin(), it->second.end(), path), it->second.end());
+
+        removeChildren(path);
+    }
+
+    [[nodiscard]] const std::vector<std::string>& getChildren(std::string_view path) const
+    {
+        static const std::vector<std::string> none;
+
+        const auto it = children.find(path);
+        return it != children.end() ? it->second : none;
+    }
+
+    void clear() { children.clear(); }
+
+private:
+    void removeChildren(std::string_view path)
+    {
+        if (const auto it = children.find(path); it != children.end())
+        {
+            const auto paths = std::move(it->second);
+            children.erase(it);
+
+            for (const auto& child: paths)
+                removeChildren(child);
+        }
+    }
+
+    ObjectPathMap<std::vector<std::string>> children;
+};
+
+} // namespace genki
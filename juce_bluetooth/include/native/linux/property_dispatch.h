@@ -0,0 +1,121 @@
+#pragma once
+
+#include <glib.h>
+#include <vector>
+
+namespace genki {
+
+//======================================================================================================================
+// Interface and property names of the PropertiesChanged signals we handle, interned as quarks once. A signal costs one
+// quark lookup per name, properties without a handler are skipped without unpacking their value.
+struct PropertyDispatchTable
+{
+    enum class Interface
+    {
+        Unknown,
+        Adapter,
+        Device,
+        Characteristic,
+    };
+
+    enum class Property
+    {
+        Unknown,
+        Connected,
+        ServicesResolved,
+        Rssi,
+        Advertisement, // ManufacturerData, ServiceData, TxPower and UUIDs
+        WriteAcquired,
+        Mtu,
+        Value,
+        Discovering,
+    };
+
+    PropertyDispatchTable()
+    {
+        add(Interface::Adapter, "Discovering", Property::Discovering);
+
+        add(Interface::Device, "Connected", Property::Connected);
+        add(Interface::Device, "ServicesResolved", Property::ServicesResolved);
+        add(Interface::Device, "RSSI", Property::Rssi);
+        add(Interface::Device, "ManufacturerData", Property::Advertisement);
+        add(Interface::Device, "ServiceData", Property::Advertisement);
+        add(Interface::Device, "TxPower", Property::Advertisement);
+        add(Interface::Device, "UUIDs", Property::Advertisement);
+
+        add(Interface::Characteristic, "WriteAcquired", Property::WriteAcquired);
+        add(Interface::Characteristic, "MTU", Property::Mtu);
+        add(Interface::Characteristic, "Value", Property::Value);
+    }
+
+    [[nodiscard]] Interface getInterface(const char* name) const
+    {
+        // Note: Names that were never interned can't be one of ours, g_quark_try_string() returns 0 for them
+        const GQuark quark = g_quark_try_string(name);
+
+        if (quark != 0 && quark == adapterInterface)
+            return Interface::Adapter;
+
+        if (quark != 0 && quark == deviceInterface)
+            return Interface::Device;
+
+        if (quark != 0 && quark == characteristicInterface)
+            return Interface::Characteristic;
+
+        return Interface::Unknown;
+    }
+
+    [[nodiscard]] Property getProperty(Interface interface, const char* name) const
+    {
+        if (const GQuark quark = g_quark_try_string(name); quark != 0)
+            for (const auto& entry: properties)
+                if (entry.quark == quark && entry.interface == interface)
+                    return entry.property;
+
+        return Property::Unknown;
+    }
+
+    // Calls fn(Property, GVariant* value) for every changed property that has a handler
+    template<typename Fn>
+    void forEachChanged(Interface interface, GVariant* changed_properties, Fn&& fn) const
+    {
+        GVariantIter iter;
+        g_variant_iter_init(&iter, changed_properties);
+
+        const gchar* key   = nullptr;
+        GVariant*    boxed = nullptr;
+
+        while (g_variant_iter_next(&iter, "{&s@v}", &key, &boxed))
+        {
+            if (const auto property = getProperty(interface, key); property != Property::Unknown)
+            {
+                GVariant* value = g_variant_get_variant(boxed);
+                fn(property, value);
+                g_variant_unref(value);
+            }
+
+            g_variant_unref(boxed);
+        }
+    }
+
+private:
+    struct Entry
+    {
+        Interface interface;
+        GQuark    quark;
+        Property  property;
+    };
+
+    void add(Interface interface, const char* name, Property property)
+    {
+        properties.push_back({interface, g_quark_from_static_string(name), property});
+    }
+
+    const GQuark adapterInterface        = g_quark_from_static_string("org.bluez.Adapter1");
+    const GQuark deviceInterface         = g_quark_from_static_string("org.bluez.Device1");
+    const GQuark characteristicInterface = g_quark_from_static_string("org.bluez.GattCharacteristic1");
+
+    std::vector<Entry> properties;
+};
+
+} // namespace genki
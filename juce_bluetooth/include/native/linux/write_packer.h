@@ -0,0 +1,80 @@
+#pragma once
+
+#include <functional>
+#include <gsl/span>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace genki {
+
+//======================================================================================================================
+// Packs consecutive writes without response to the same characteristic into packets of up to the maximum value length,
+// framed by the append function of BleDevice::WriteCoalescing. Closed packets are handed to emit(Packet&&) in order.
+class WritePacker
+{
+public:
+    using Append = std::function<bool(std::vector<gsl::byte>& packet, gsl::span<const gsl::byte> message, size_t maxLength)>;
+
+    struct Packet
+    {
+        std::string            objectPath;
+        std::vector<gsl::byte> data;
+    };
+
+    enum class Result
+    {
+        Appended,  // Added to the open packet
+        Opened,    // Started a new packet, the flush deadline starts now
+        Oversized, // Doesn't fit a packet, sent on its own
+    };
+
+    template<typename Emit>
+    Result add(const Append& append, std::string_view objectPath, gsl::span<const gsl::byte> message, size_t maxLength, Emit&& emit)
+    {
+        // Packets only ever target one characteristic, interleaved writes close the open packet to keep the order
+        if (packet.has_value() && packet->objectPath != objectPath)
+            close(emit);
+
+        auto result = Result::Appended;
+
+        if (!packet.has_value() || !append(packet->data, message, maxLength))
+        {
+            close(emit);
+
+            packet = Packet{std::string(objectPath), {}};
+            packet->data.reserve(maxLength);
+
+            result = Result::Opened;
+
+            if (!append(packet->data, message, maxLength))
+            {
+                packet->data.assign(message.begin(), message.end());
+                result = Result::Oversized;
+            }
+        }
+
+        if (packet->data.size() >= maxLength)
+            close(emit);
+
+        return result;
+    }
+
+    template<typename Emit>
+    void close(Emit&& emit)
+    {
+        if (!packet.has_value())
+            return;
+
+        emit(std::move(*packet));
+        packet.reset();
+    }
+
+    [[nodiscard]] bool isOpen() const noexcept { return packet.has_value(); }
+
+private:
+    std::optional<Packet> packet;
+};
+
+} // namespace genki
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <gsl/span>
+
+namespace genki {
+
+//======================================================================================================================
+// Preallocated single-producer/single-consumer ring of (timestamp, value) records. The Bluetooth backend produces, one
+// other thread (e.g. the audio thread) consumes. Neither side locks, allocates or makes syscalls.
+class NotificationRing
+{
+public:
+    enum class OverflowPolicy
+    {
+        Discard,            // Notifications that don't fit are dropped
+        FallBackToCallback, // Notifications that don't fit are delivered through BleDevice::Callbacks::valueChanged
+    };
+
+    struct Notification
+    {
+        int64_t                    timestamp; // juce::Time::getHighResolutionTicks() at reception
+        gsl::span<const gsl::byte> value;
+    };
+
+    // Capacity is rounded up to a power of two, longer values are truncated to maxValueLength
+    NotificationRing(size_t capacity, size_t maxValueLength, OverflowPolicy policy = OverflowPolicy::Discard)
+        : mask(static_cast<size_t>(juce::nextPowerOfTwo(static_cast<int>(std::max<size_t>(capacity, 2)))) - 1),
+          slotSize(maxValueLength),
+          overflowPolicy(policy),
+          slots(mask + 1),
+          values((mask + 1) * maxValueLength)
+    {
+    }
+
+    [[nodiscard]] size_t         getCapacity() const noexcept { return mask + 1; }
+    [[nodiscard]] size_t         getMaxValueLength() const noexcept { return slotSize; }
+    [[nodiscard]] OverflowPolicy getOverflowPolicy() const noexcept { return overflowPolicy; }
+
+    //==================================================================================================================
+    // Producer side, returns false if the ring is full
+    bool push(gsl::span<const gsl::byte> value, int64_t timestamp = juce::Time::getHighResolutionTicks()) noexcept
+    {
+        const auto write_index = writeIndex.load(std::memory_order_relaxed);
+
+        if (write_index - readIndex.load(std::memory_order_acquire) > mask)
+        {
+            numOverflows.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        const auto length = std::min(value.size(), slotSize);
+
+        if (length < value.size())
+            numTruncated.fetch_add(1, std::memory_order_relaxed);
+
+        auto& slot     = slots[write_index & mask];
+        slot.timestamp = timestamp;
+        slot.length    = length;
+
+        std::copy_n(value.begin(), length, values.begin() + static_cast<ptrdiff_t>((write_index & mask) * slotSize));
+
+        writeIndex.store(write_index + 1, std::memory_order_release);
+        numPushed.fetch_add(1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    // Returns true if the ring took care of the value: it was pushed, or dropped under OverflowPolicy::Discard. The
+    // value is left to the valueChanged callback otherwise.
+    bool offer(gsl::span<const gsl::byte> value, int64_t timestamp = juce::Time::getHighResolutionTicks()) noexcept
+    {
+        return push(value, timestamp) || overflowPolicy == OverflowPolicy::Discard;
+    }
+
+    //==================================================================================================================
+    // Consumer side, calls fn(const Notification&) for up to maxCount records in arrival order. The value only stays
+    // valid for the duration of the call.
+    template<typename Fn>
+    size_t consume(Fn&& fn, size_t maxCount = std::numeric_limits<size_t>::max())
+    {
+        const auto read_index = readIndex.load(std::memory_order_relaxed);
+        const auto count      = std::min(writeIndex.load(std::memory_order_acquire) - read_index, maxCount);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const auto  index = (read_index + i) & mask;
+            const auto& slot  = slots[index];
+
+            fn(Notification{slot.timestamp, gsl::span<const gsl::byte>(values.data() + index * slotSize, slot.length)});
+        }
+
+        readIndex.store(read_index + count, std::memory_order_release);
+
+        return count;
+    }
+
+    [[nodiscard]] size_t getNumReady() const noexcept
+    {
+        return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire);
+    }
+
+    //==================================================================================================================
+    [[nodiscard]] uint64_t getNumPushed() const noexcept { return numPushed.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t getNumOverflows() const noexcept { return numOverflows.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t getNumTruncated() const noexcept { return numTruncated.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot
+    {
+        int64_t timestamp = 0;
+        size_t  length    = 0;
+    };
+
+    const size_t         mask;
+    const size_t         slotSize;
+    const OverflowPolicy overflowPolicy;
+
+    std::vector<Slot>      slots;
+    std::vector<gsl::byte> values;
+
+    alignas(64) std::atomic<size_t> writeIndex{0};
+    alignas(64) std::atomic<size_t> readIndex{0};
+
+    alignas(64) std::atomic<uint64_t> numPushed{0};
+    std::atomic<uint64_t> numOverflows{0};
+    std::atomic<uint64_t> numTruncated{0};
+
+    JUCE_DECLARE_NON_COPYABLE(NotificationRing)
+};
+
+} // namespace genki
@@ -31,8 +31,15 @@
 
 #include <gsl/span>
 
+#include "include/advertisement_data.h"
+#include "include/advertisement_throttle.h"
+#include "include/device_expiry.h"
+#include "include/device_index.h"
+#include "include/device_registry.h"
 #include "include/identifiers.h"
+#include "include/known_devices.h"
 #include "include/message.h"
+#include "include/notification_ring.h"
 #include "include/valuetrees.h"
 
 //======================================================================================================================
@@ -42,10 +49,16 @@ struct BleAdapter;
 
 struct BleDevice
 {
+    // On Linux these run on the message thread, or on the I/O thread with GENKI_BLUETOOTH_IO_THREAD. The other
+    // backends call them from the threads of the platform's Bluetooth stack.
     struct Callbacks
     {
         std::function<void(const juce::Uuid&, gsl::span<const gsl::byte>)> valueChanged;
         std::function<void(const juce::Uuid&, bool)>                       characteristicWritten;
+
+        // Descriptors are identified by their characteristic's UUID and their own. Linux only.
+        std::function<void(const juce::Uuid&, const juce::Uuid&, gsl::span<const gsl::byte>)> descriptorRead;
+        std::function<void(const juce::Uuid&, const juce::Uuid&, bool)>                       descriptorWritten;
     };
 
     BleDevice() = default;
@@ -54,6 +67,42 @@ struct BleDevice
 
     void write(BleAdapter&, const juce::Uuid& charact, gsl::span<const gsl::byte> data, bool withResponse = true);
 
+    //==================================================================================================================
+    // Typed equivalents of the DISCOVER_SERVICES, DISCOVER_CHARACTERISTICS and ENABLE_NOTIFICATIONS messages. On Linux
+    // they reach the backend directly, without notifying the listeners of the state.
+    void discoverServices(BleAdapter&);
+
+    // Services, characteristics with their properties and descriptors at once, followed by one ALL_DISCOVERED message.
+    // Same as the DISCOVER_ALL message. Linux only.
+    void discoverAll(BleAdapter&);
+
+    void discoverCharacteristics(BleAdapter&, const juce::Uuid& service);
+    void enableNotifications(BleAdapter&, const juce::Uuid& charact, bool acquire = false);
+
+    // Same as the READ_DESCRIPTOR and WRITE_DESCRIPTOR messages. Read values are set on the DESCRIPTOR node as ID::value
+    // and passed to descriptorRead. BlueZ rejects writes to the Client Characteristic Configuration descriptor, use
+    // enableNotifications() instead. Linux only.
+    void readDescriptor(BleAdapter&, const juce::Uuid& charact, const juce::Uuid& descriptor);
+    void writeDescriptor(BleAdapter&, const juce::Uuid& charact, const juce::Uuid& descriptor, gsl::span<const gsl::byte> data);
+
+    //==================================================================================================================
+    struct WriteCoalescing
+    {
+        // Frames a message into a packet. Returns false, leaving the packet untouched, if it would exceed maxLength.
+        std::function<bool(std::vector<gsl::byte>& packet, gsl::span<const gsl::byte> message, size_t maxLength)> append;
+
+        // How long a partially filled packet waits for more messages
+        int flushDeadlineUs = 1000;
+    };
+
+    // Packs consecutive writes without response to the same characteristic into packets of up to the maximum value
+    // length. characteristicWritten is called once per packet. Pass an empty policy to turn it off. Linux only.
+    void setWriteCoalescing(BleAdapter&, WriteCoalescing);
+
+    // Routes notifications of a discovered characteristic into the ring instead of valueChanged, pass nullptr to stop.
+    // The backend pushes from the thread it runs on, the I/O thread with GENKI_BLUETOOTH_IO_THREAD. Linux only.
+    void setNotificationRing(BleAdapter&, const juce::Uuid& charact, std::shared_ptr<NotificationRing>);
+
     //==================================================================================================================
     juce::ValueTree state{};
 };
@@ -61,7 +110,10 @@ struct BleDevice
 //======================================================================================================================
 struct BleAdapter : private juce::Timer
 {
-    static constexpr int TimeoutMs = 5000;
+    static constexpr int DefaultTimeoutMs = 5000;
+
+    // Former name of DefaultTimeoutMs, the timeout itself is now set with setDeviceTimeout()
+    static constexpr int TimeoutMs = DefaultTimeoutMs;
 
     BleAdapter();
     BleAdapter(juce::ValueTree::Listener&);
@@ -74,14 +126,22 @@ struct BleAdapter : private juce::Timer
                        : AdapterStatus::Disabled;
     }
 
-    void scan(bool shouldStart, const std::initializer_list<juce::Uuid>& uuids = {})
+    using UpdatePolicy = AdvertisementThrottle::Policy;
+
+    // The policy limits how often advertisements update the rssi, name, advertisement and last_seen of known devices.
+    // last_seen is then only updated as often as the device timeout requires. Linux and macOS.
+    void scan(bool shouldStart, const std::initializer_list<juce::Uuid>& uuids = {}, UpdatePolicy policy = {});
+
+    // The SCAN message equivalent to scan()
+    static juce::ValueTree makeScanMessage(bool shouldStart, const std::initializer_list<juce::Uuid>& uuids, UpdatePolicy policy)
     {
         juce::ValueTree vt{ID::SCAN, {{ID::should_start, shouldStart}}};
+        AdvertisementThrottle::setPolicy(vt, policy);
 
         for (const auto& uuid: uuids)
             vt.appendChild({ID::SERVICE, {{ID::uuid, uuid.toDashedString()}}}, nullptr);
 
-        message(state, vt);
+        return vt;
     }
 
     [[nodiscard]] BleDevice connect(const juce::ValueTree&, const BleDevice::Callbacks&) const;
@@ -90,29 +150,96 @@ struct BleAdapter : private juce::Timer
 
     size_t getMaximumValueLength(const BleDevice&);
 
-    void timerCallback() override
+    // Devices that haven't been seen for this long are removed, unless connected
+    void setDeviceTimeout(int timeoutMs) { expiry.setTimeout(timeoutMs); }
+
+    [[nodiscard]] int getDeviceTimeout() const { return expiry.getTimeout(); }
+
+    // Upper bound on writes handed to the platform at once per device, further writes wait in submission order
+    void setMaxWritesInFlight(size_t withResponse, size_t withoutResponse);
+
+    // Writes queued or in flight for the device, producers can use it to throttle themselves
+    [[nodiscard]] size_t getNumPendingWrites(const BleDevice&) const;
+
+    // Keeps the GATT database of connected devices in this directory. On reconnect, services and characteristics are
+    // restored from it once the device is connected, without waiting for service resolution, and subscriptions once its
+    // Database Hash is found unchanged. Linux only.
+    void setGattCacheDirectory(const juce::File& directory);
+
+    // Keeps scanned devices in the registry instead of the state, see promote(). Linux only.
+    void setCompactScanning(bool shouldBeCompact);
+
+    // Returns the node of a device, creating it from the registry or the known devices if needed. Invalid if the device
+    // is unknown.
+    juce::ValueTree promote(const juce::String& address)
     {
-        const auto now = static_cast<int>(juce::Time::getMillisecondCounter());
+        if (auto device = deviceIndex->find(address); device.isValid())
+            return device;
+
+        // Nodes carry the address formatted like toAddressString(), whatever format it was passed in
+        const auto key = DeviceRegistry::toKey(address);
 
-        std::vector<juce::ValueTree> to_remove{};
+        if (auto device = deviceIndex->find(DeviceRegistry::toAddressString(key)); key != 0 && device.isValid())
+            return device;
 
-        for (auto d: state)
+        if (const auto device = registry.promote(key))
         {
-            const int  last_seen    = d.getProperty(ID::last_seen);
-            const bool is_connected = d.getProperty(ID::is_connected);
+            juce::ValueTree vt{ID::BLUETOOTH_DEVICE, {{ID::name, device->name}, {ID::address, DeviceRegistry::toAddressString(key)}, {ID::rssi, device->rssi}, {ID::is_connected, false}, {ID::last_seen, device->lastSeen}}};
 
-            if (d.hasType(ID::BLUETOOTH_DEVICE))
-                if (!is_connected && (now - last_seen) > TimeoutMs)
-                    to_remove.push_back(d);
+            if (!device->advertisement.isEmpty())
+                vt.setProperty(ID::advertisement, device->advertisement, nullptr);
+
+            state.appendChild(vt, nullptr);
+            return vt;
         }
 
-        for (const auto& vt: to_remove)
-            state.removeChild(vt, nullptr);
+        // Not seen since startup, but connected to before
+        if (const auto device = knownDevices.find(address))
+        {
+            juce::ValueTree vt{ID::BLUETOOTH_DEVICE, {{ID::name, device->name}, {ID::address, DeviceRegistry::toAddressString(key)}, {ID::rssi, 0}, {ID::is_connected, false}, {ID::last_seen, static_cast<int>(juce::Time::getMillisecondCounter())}}};
+            state.appendChild(vt, nullptr);
+            return vt;
+        }
+
+        return {};
+    }
+
+    // Remembers connected devices in this file, so that promote() and connect() work for them straight after startup
+    // without scanning. Linux only.
+    void setKnownDevicesFile(const juce::File& file) { knownDevices.setFile(file); }
+
+    using AdvertisementCallback = std::function<void(const juce::String& address, const AdvertisementData&)>;
+
+    // Called whenever the advertisement record of a device changes, before it is set on the device state. Runs on the
+    // Bluetooth thread (the I/O thread with GENKI_BLUETOOTH_IO_THREAD, the message thread otherwise), the record is
+    // only valid for the duration of the call. Linux only.
+    void setAdvertisementCallback(AdvertisementCallback);
+
+    void timerCallback() override
+    {
+        const auto now = static_cast<int>(juce::Time::getMillisecondCounter());
+
+        expiry.removeExpired(now);
+        registry.removeExpired(now, expiry.getTimeout());
+
+        knownDevices.flush();
     }
 
     //==================================================================================================================
     juce::ValueTree state{ID::BLUETOOTH_ADAPTER};
 
+    DeviceExpiry expiry{state, DefaultTimeoutMs};
+
+    // Address lookup for promote(), shared with the Linux backend whose updates posted to the message thread may
+    // outlive the adapter
+    std::shared_ptr<DeviceIndex> deviceIndex = std::make_shared<DeviceIndex>(state);
+
+    // Scanned devices without a node, when compact scanning
+    DeviceRegistry registry;
+
+    // Devices connected to before, see setKnownDevicesFile()
+    KnownDevices knownDevices;
+
     struct Impl;
     std::unique_ptr<Impl> impl;
 };
@@ -5,7 +5,15 @@
 #include "juce_bluetooth.h"
 #include "juce_bluetooth_log.h"
 
+// Runs the backend on a dedicated thread with a private GMainContext, the JUCE message loop patch is not needed then
+#ifndef GENKI_BLUETOOTH_IO_THREAD
+#define GENKI_BLUETOOTH_IO_THREAD 0
+#endif
+
+#include <glib-unix.h>
 #include <glib.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "org-bluez-Adapter1.h"
 #include "org-bluez-Device1.h"
@@ -18,42 +26,284 @@
 
 #include "format.h"
 #include "native/linux/bluez_utils.h"
+#include "native/linux/gatt_cache.h"
+#include "native/linux/glib_sources.h"
+#include "native/linux/io_thread.h"
+#include "native/linux/notify_channel.h"
+#include "native/linux/object_paths.h"
+#include "native/linux/property_dispatch.h"
+#include "native/linux/write_packer.h"
 #include "ranges.h"
 
 using namespace juce;
 
-namespace ID {
-const juce::Identifier dbus_object_path("dbus_object_path");
-}
-
 namespace genki {
 //======================================================================================================================
-struct LambdaTimer : public juce::Timer
+struct BleAdapter::Impl : private juce::ValueTree::Listener
 {
-    LambdaTimer(std::function<void()> cb, int intervalMs) : callback(std::move(cb)) { startTimer(intervalMs); }
+    Impl(ValueTree, std::shared_ptr<DeviceIndex>, DeviceRegistry&, KnownDevices&);
+    ~Impl() override;
+
+    void openAdapter();
+    void releaseResources();
+
+    static constexpr uint16_t DefaultAttMtu = 23;
+
+    static constexpr guint KnownDeviceScanTimeoutMs = 30000;
 
-    ~LambdaTimer() override { stopTimer(); }
+    struct CharacteristicCacheEntry;
 
-    void timerCallback() override
+    //==================================================================================================================
+    // Write-without-response channel backed by the socket returned by GattCharacteristic1.AcquireWrite. Each write is
+    // a single send() on the socket, BlueZ turns every packet into one ATT Write Command.
+    struct WriteChannel
     {
-        if (callback) callback();
-    }
+        WriteChannel(Impl& o, juce::String path)
+            : owner(o),
+              dbusObjectPath(std::move(path))
+        {
+        }
 
-    std::function<void()> callback;
-};
+        ~WriteChannel() { release(); }
 
-struct BleAdapter::Impl : private juce::ValueTree::Listener
-{
-    explicit Impl(ValueTree);
-    ~Impl() override;
+        void acquired(int f, uint16_t m)
+        {
+            fd          = f;
+            mtu         = m;
+            isAcquiring = false;
+
+            source = add_fd_watch(fd, static_cast<GIOCondition>(G_IO_HUP | G_IO_ERR), &WriteChannel::onSocketClosed, this);
+        }
+
+        void release()
+        {
+            destroy_source(source);
+            destroy_source(writableSource);
+
+            if (fd >= 0)
+                close(fd);
+
+            fd  = -1;
+            mtu = 0;
+        }
+
+        // Note: BlueZ reports the ATT MTU, the 3 byte ATT header is not part of the payload
+        [[nodiscard]] size_t getMaximumValueLength() const { return mtu > 3 ? static_cast<size_t>(mtu - 3) : 0; }
+
+        // The socket buffer is full, the pipeline is resumed once there is room again
+        void waitUntilWritable()
+        {
+            if (writableSource == nullptr)
+                writableSource = add_fd_watch(fd, G_IO_OUT, &WriteChannel::onSocketWritable, this);
+        }
+
+        static gboolean onSocketClosed(gint, GIOCondition, gpointer user_data)
+        {
+            auto* c = static_cast<WriteChannel*>(user_data);
+            c->owner.writeChannelLost(c->dbusObjectPath);
+
+            return G_SOURCE_REMOVE;
+        }
+
+        static gboolean onSocketWritable(gint, GIOCondition, gpointer user_data)
+        {
+            auto* c = static_cast<WriteChannel*>(user_data);
+
+            destroy_source(c->writableSource);
+            c->owner.writeChannelWritable(c->dbusObjectPath);
+
+            return G_SOURCE_REMOVE;
+        }
+
+        Impl&              owner;
+        const juce::String dbusObjectPath;
+
+        int      fd             = -1;
+        uint16_t mtu            = 0;
+        GSource* source         = nullptr;
+        GSource* writableSource = nullptr;
+
+        bool isAcquiring   = false;
+        bool isUnsupported = false;
+    };
+
+    //==================================================================================================================
+    // Every discovered characteristic, the typed proxy is created once at discovery and reused for all operations
+    struct CharacteristicCacheEntry : NotifyChannel::Provider
+    {
+        CharacteristicCacheEntry(Impl& o, CharacteristicProxy charact, juce::String addr, juce::Uuid u, const genki::BleDevice::Callbacks* cbs, juce::ValueTree vt)
+            : owner(o),
+              characteristicProxy(std::move(charact)),
+              address(std::move(addr)),
+              uuid(std::move(u)),
+              callbacks(cbs),
+              state(std::move(vt))
+        {
+        }
+
+        void acquireNotify(NotifyChannel& channel) override { owner.acquireNotify(*this, channel); }
+
+        void startNotify(NotifyChannel& channel) override { owner.startNotify(*this, channel); }
+
+        void notificationReceived(NotifyChannel&, gsl::span<const gsl::byte> data) override { owner.deliverValue(*this, data); }
+
+        void notificationsEnabled(NotifyChannel& channel) override { owner.notificationsEnabled(*this, channel); }
+
+        // BlueZ also hangs up when another client stops notifications, a connected device gets a new socket
+        bool shouldReacquire(NotifyChannel&) override { return owner.connections.find(address) != owner.connections.end(); }
+
+        Impl&                              owner;
+        CharacteristicProxy                characteristicProxy;
+        const juce::String                 address;
+        const juce::Uuid                   uuid;
+        const genki::BleDevice::Callbacks* callbacks;
+        juce::ValueTree                    state;
+
+        // Created by the first ENABLE_NOTIFICATIONS
+        std::unique_ptr<NotifyChannel> notifyChannel;
+        std::unique_ptr<WriteChannel>  writeChannel;
+
+        // Set by real-time consumers, takes precedence over the valueChanged callback
+        std::shared_ptr<NotificationRing> notificationRing;
+    };
+
+    // Every discovered descriptor, the proxy is created along with its characteristic's and reused for reads and writes
+    struct DescriptorCacheEntry
+    {
+        DescriptorProxy                    descriptorProxy;
+        juce::String                       address;
+        juce::Uuid                         uuid;
+        juce::Uuid                         characteristicUuid;
+        const genki::BleDevice::Callbacks* callbacks;
+        juce::ValueTree                    state;
+    };
+
+    //==================================================================================================================
+    struct PendingWrite
+    {
+        std::string            objectPath;
+        std::vector<gsl::byte> data;
+        bool                   withResponse;
+    };
+
+    // Ordered write queue of a connected device, the id tells replies for a torn down pipeline apart
+    struct WritePipeline
+    {
+        WritePipeline() = default;
+
+        ~WritePipeline() { destroy_source(flushSource); }
+
+        void queuePacket(WritePacker::Packet&& packet) { queue.push_back({std::move(packet.objectPath), std::move(packet.data), false}); }
+
+        uint32_t                 id = 0;
+        std::deque<PendingWrite> queue;
+        size_t                   inFlightWithResponse    = 0;
+        size_t                   inFlightWithoutResponse = 0;
+
+        // Mirrors the size of the pipeline for getNumPendingWrites()
+        std::atomic<size_t> numPending{0};
+
+        // Writes without response are packed into the open packet until it is full or the flush deadline passes
+        BleDevice::WriteCoalescing coalescing;
+        WritePacker                packer;
+        GSource*                   flushSource = nullptr;
+
+        JUCE_DECLARE_NON_COPYABLE(WritePipeline)
+    };
+
+    // GATT database of a connected device as discovered so far, written to the GATT cache when it goes away
+    struct CachedDatabase
+    {
+        GattDatabase database;
+
+        // Restored from the GATT cache and not yet checked against the device's Database Hash
+        bool isRestored = false;
+    };
+
+    // Owned by a source attached on behalf of a device, freed when the source is destroyed
+    struct SourceContext
+    {
+        Impl*        owner;
+        juce::String address;
+    };
+
+    // Context of a single WriteValue call, owned by the completion callback
+    struct WriteOperation
+    {
+        Impl*        owner;
+        juce::String address;
+        uint32_t     pipelineId;
+        bool         withResponse;
+    };
+
+    // Context of a write that went out on the socket, owned by the idle source reporting it
+    struct SocketWriteOperation
+    {
+        Impl*       owner;
+        std::string objectPath;
+        bool        success;
+    };
+
+    // What became of the write at the front of a pipeline
+    enum class WriteResult
+    {
+        InFlight, // Went out through D-Bus, occupies an in-flight slot until BlueZ replies
+        Done,     // Went out on the write socket, or was dropped
+        Blocked,  // Stays at the front of the queue until the write socket is ready for it
+    };
+
+    // Our discovery session, driven one async call at a time towards what was last requested. Requests made while a
+    // call is in flight only change the target, so rapid toggles collapse into at most one call per step.
+    struct ScanControl
+    {
+        enum class Call
+        {
+            None,
+            SetFilter,
+            Start,
+            Stop,
+        };
+
+        bool              wantsScan  = false;
+        juce::StringArray wantedUuids;
+        bool              isScanning = false;
+        juce::StringArray filterUuids; // As last set on the adapter, no filter to begin with
+        juce::StringArray pendingFilterUuids;
+        Call              inFlight   = Call::None;
+    };
+
+    //==================================================================================================================
+    // With the I/O thread, D-Bus and the caches below are only touched on it and the ValueTree only on the message
+    // thread. Without it, both run on the message thread.
+    // Without the I/O thread the command is called in place, nothing is allocated for it
+    template<typename Fn>
+    void runOnIoThread(Fn&& fn)
+    {
+        if (ioThread != nullptr)
+            ioThread->invoke(std::forward<Fn>(fn));
+        else
+            fn();
+    }
+
+    void runOnMessageThread(std::function<void()> fn) const
+    {
+        if (ioThread != nullptr)
+            juce::MessageManager::callAsync(std::move(fn));
+        else
+            fn();
+    }
 
     //==================================================================================================================
-    void connect(const juce::ValueTree& deviceState, const BleDevice::Callbacks& callbacks)
+    void connect(const juce::String& address, const BleDevice::Callbacks& callbacks)
     {
-        const juce::String address = deviceState.getProperty(ID::address);
+        // The proxy exported through the object manager if there is one, scanned devices always have one
+        auto device_proxy = bluez_utils::get_device_proxy(dbusObjectManager, bluezAdapter, address);
+        auto known        = device_proxy == nullptr ? knownDevices.find(address) : std::nullopt;
+
+        if (device_proxy == nullptr && !known.has_value())
+            device_proxy = bluez_utils::get_device_for_address(bluezAdapter, address);
 
-        const auto& [it, was_inserted] = connections.insert({address,
-                                                             std::make_pair(bluez_utils::get_device_for_address(bluezAdapter, address), callbacks)});
+        const auto& [it, was_inserted] = connections.insert({address, std::make_pair(std::move(device_proxy), callbacks)});
 
         if (!was_inserted)
         {
@@ -61,6 +311,41 @@ struct BleAdapter::Impl : private juce::ValueTree::Listener
             return;
         }
 
+        // Characteristics imported at startup were cached before the device was ours
+        attachCallbacks(address, &it->second.second);
+
+        // Known to us but not to BlueZ, e.g. after its cache was cleared
+        if (it->second.first == nullptr)
+            connectKnownDevice(*known);
+        else
+            connectDevice(it->second.first.get());
+    }
+
+    void attachCallbacks(const juce::String& address, const BleDevice::Callbacks* callbacks)
+    {
+        if (const auto it = characteristicsByDevice.find(address); it != characteristicsByDevice.end())
+        {
+            for (const auto& object_path: it->second)
+            {
+                if (const auto cit = characteristicCache.find(object_path); cit != characteristicCache.end())
+                    cit->second.callbacks = callbacks;
+
+                if (const auto dit = descriptorCache.find(object_path); dit != descriptorCache.end())
+                    dit->second.callbacks = callbacks;
+            }
+        }
+    }
+
+    void connectDevice(OrgBluezDevice1* device)
+    {
+        // Already connected with its services resolved, e.g. by another client or from before we started. BlueZ has
+        // nothing left to signal.
+        if (org_bluez_device1_get_connected(device) && org_bluez_device1_get_services_resolved(device))
+        {
+            deviceConnected(device, true);
+            return;
+        }
+
         const auto on_device_connected = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
         {
             auto* p = reinterpret_cast<BleAdapter::Impl*>(user_data);
@@ -78,8 +363,6 @@ struct BleAdapter::Impl : private juce::ValueTree::Listener
             }
         };
 
-        OrgBluezDevice1* device = it->second.first.get();
-
         org_bluez_device1_call_connect(
                 device,
                 nullptr, // cancelable
@@ -87,14 +370,152 @@ struct BleAdapter::Impl : private juce::ValueTree::Listener
                 this);
     }
 
-    void disconnect(const BleDevice& device)
+    // Adapter1.ConnectDevice (BlueZ 5.49 and later) creates the device object from the stored address and connects
+    // right away, no scan needed. Connected and ServicesResolved follow as for any other device. The method is
+    // experimental, without it the device is scanned for and connected once found.
+    void connectKnownDevice(const KnownDevices::Device& device)
+    {
+        LOG(fmt::format("Bluetooth - Connecting known device: {} ({})", device.name, device.address));
+
+        const auto on_device_created = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
+        {
+            const auto ctx = std::unique_ptr<SourceContext>(static_cast<SourceContext*>(user_data));
+            auto*      p   = ctx->owner;
+
+            GError*   err    = nullptr;
+            GVariant* result = g_dbus_proxy_call_finish(G_DBUS_PROXY(source_object), res, &err);
+
+            const auto it = p->connections.find(ctx->address);
+
+            // Disconnected in the meantime
+            if (it == p->connections.end())
+            {
+                if (result != nullptr)
+                    g_variant_unref(result);
+                else
+                    g_error_free(err);
+
+                return;
+            }
+
+            if (result == nullptr)
+            {
+                if (g_error_matches(err, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+                    LOG("Bluetooth - Adapter1.ConnectDevice is not available, run bluetoothd with --experimental to connect known devices without scanning");
+                else
+                    LOG(fmt::format("Bluetooth - ConnectDevice failed: {}", err->message));
+
+                g_error_free(err);
+            }
+            else
+            {
+                g_variant_unref(result);
+            }
+
+            // Created by ConnectDevice, or there after all. Otherwise deviceObjectAdded() takes over.
+            if (auto device = bluez_utils::get_device_proxy(p->dbusObjectManager, p->bluezAdapter, ctx->address); device != nullptr)
+            {
+                it->second.first = std::move(device);
+
+                if (result == nullptr)
+                    p->connectDevice(it->second.first.get());
+            }
+            else if (result == nullptr)
+            {
+                p->awaitDevice(ctx->address);
+            }
+        };
+
+        GVariantBuilder builder{};
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&builder, "{sv}", "Address", g_variant_new_string(bluez_utils::get_native_address_string(device.address).toRawUTF8()));
+        g_variant_builder_add(&builder, "{sv}", "AddressType", g_variant_new_string(device.addressType.isNotEmpty() ? device.addressType.toRawUTF8() : "public"));
+
+        g_dbus_proxy_call(
+                G_DBUS_PROXY(bluezAdapter),
+                "ConnectDevice",
+                g_variant_new("(a{sv})", &builder),
+                G_DBUS_CALL_FLAGS_NONE,
+                -1,      // default timeout
+                nullptr, // cancelable
+                on_device_created,
+                new SourceContext{this, device.address});
+    }
+
+    // Scans for a known device BlueZ has no object for, see deviceObjectAdded()
+    void awaitDevice(const juce::String& address)
+    {
+        LOG(fmt::format("Bluetooth - Scanning for known device: {}", address));
+
+        auto& source = awaitedDevices[address];
+
+        destroy_source(source);
+
+        source = g_timeout_source_new(KnownDeviceScanTimeoutMs);
+        g_source_set_callback(
+                source,
+                [](gpointer user_data) -> gboolean
+                {
+                    auto* ctx = static_cast<SourceContext*>(user_data);
+
+                    LOG(fmt::format("Bluetooth - Known device not found: {}", ctx->address));
+
+                    // Note: The context stays alive until the callback returns
+                    if (ctx->owner->stopAwaitingDevice(ctx->address))
+                        ctx->owner->deviceDisconnected(ctx->address);
+
+                    return G_SOURCE_REMOVE;
+                },
+                new SourceContext{this, address},
+                [](gpointer user_data) { delete static_cast<SourceContext*>(user_data); });
+        g_source_attach(source, g_main_context_get_thread_default());
+
+        updateScan();
+    }
+
+    // Returns false if the device wasn't being scanned for
+    bool stopAwaitingDevice(const juce::String& address)
     {
-        const auto addr = device.state.getProperty(ID::address).toString();
+        const auto it = awaitedDevices.find(address);
+
+        if (it == awaitedDevices.end())
+            return false;
+
+        destroy_source(it->second);
+        awaitedDevices.erase(it);
+
+        updateScan();
+        return true;
+    }
+
+    // Both ConnectDevice and the scan failed, the connections are dropped like any other failed one
+    void awaitedDevicesNotFound()
+    {
+        while (!awaitedDevices.empty())
+        {
+            const auto address = awaitedDevices.begin()->first;
+
+            stopAwaitingDevice(address);
+            deviceDisconnected(address);
+        }
+    }
 
-        clearCharacteristicCacheForDevice(addr);
+    void disconnect(const juce::String& addr)
+    {
+        releaseDevice(addr);
 
         if (const auto it = connections.find(addr); it != connections.end())
         {
+            // A known device BlueZ has no object for yet, see connectKnownDevice()
+            if (it->second.first == nullptr)
+            {
+                LOG(fmt::format("Bluetooth - Connection attempt cancelled: {}", addr));
+
+                stopAwaitingDevice(addr);
+                connections.erase(it);
+                return;
+            }
+
             LOG(fmt::format("Bluetooth - Disconnect device: {}", addr));
 
             const auto on_device_disconnected = [](GObject* source_object, GAsyncResult* res, gpointer)
@@ -120,519 +541,1856 @@ struct BleAdapter::Impl : private juce::ValueTree::Listener
         }
     }
 
-    void writeCharacteristic(const BleDevice& device, const juce::Uuid& charactUuid, gsl::span<const gsl::byte> data, bool withResponse)
+    // Writes are queued per device and issued strictly in submission order. A write only leaves the queue once its
+    // kind (with or without response) has a free in-flight slot, so a slow request holds back everything behind it.
+    // Writes without response also wait for the characteristic's write socket, see sendOnWriteChannel().
+    void writeCharacteristic(const juce::String& address, const juce::Uuid& charactUuid, gsl::span<const gsl::byte> data, bool withResponse)
     {
-        const auto addr = device.state.getProperty(ID::address).toString();
+        const auto it = findCharacteristic(address, charactUuid);
 
-        if (const auto& vt = findChildWithProperty(device.state, ID::uuid, charactUuid.toDashedString()); vt.isValid())
+        if (it == characteristicCache.end())
         {
-            const juce::String characteristic_object_path = vt.getProperty(ID::dbus_object_path);
-            GDBusObject*       obj                        = g_dbus_object_manager_get_object(dbusObjectManager, characteristic_object_path.getCharPointer());
-
-            if (obj != nullptr)
-            {
-                GDBusInterface* interface = g_dbus_object_get_interface(obj, "org.bluez.GattCharacteristic1");
+            LOG(fmt::format("Bluetooth - Characteristic not discovered: {}", charactUuid.toDashedString()));
+            return;
+        }
 
-                if (interface != nullptr)
-                {
-                    const auto on_write_complete = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
-                    {
-                        GError* err = nullptr;
+        auto& pipeline = getWritePipeline(address);
 
-                        OrgBluezGattCharacteristic1* charact = ORG_BLUEZ_GATT_CHARACTERISTIC1(source_object);
-                        auto*                        p       = reinterpret_cast<BleAdapter::Impl*>(user_data);
+        if (!withResponse && pipeline.coalescing.append)
+        {
+            coalesceWrite(address, pipeline, it->first, it->second, data);
+            return;
+        }
 
-                        const auto& cc = p->characteristicCache;
+        // Anything packed so far was submitted before this write
+        closeOpenPacket(pipeline);
 
-                        const char* object_path = g_dbus_proxy_get_object_path(G_DBUS_PROXY(charact));
+        pipeline.queue.push_back({it->first, std::vector<gsl::byte>(data.begin(), data.end()), withResponse});
 
-                        const auto it = std::find_if(cc.begin(), cc.end(), [&](const auto& ent)
-                                                     { return ent.dbusObjectPath.compare(object_path) == 0; });
+        processPendingWrites(address);
+    }
 
-                        bool success = org_bluez_gatt_characteristic1_call_start_notify_finish(charact, res, &err);
+    WritePipeline& getWritePipeline(const juce::String& address)
+    {
+        const juce::ScopedLock lock(writePipelinesLock);
 
-                        if (!success)
-                        {
-                            const auto uuid = juce::Uuid(juce::String(org_bluez_gatt_characteristic1_get_uuid(charact)));
-                            LOG(fmt::format("Bluetooth - Error writing characteristic: {} - {}\n", uuid.toDashedString(), err->message));
+        auto& pipeline = writePipelines[address];
 
-                            g_error_free(err);
-                        }
+        if (pipeline.id == 0)
+            pipeline.id = ++lastWritePipelineId;
 
-                        if (it != cc.end())
-                            it->callbacks->characteristicWritten(it->uuid, success);
+        return pipeline;
+    }
 
-                        g_object_unref(charact);
-                    };
+    void setWriteCoalescing(const juce::String& address, BleDevice::WriteCoalescing coalescing)
+    {
+        auto& pipeline = getWritePipeline(address);
 
-                    GError* error = nullptr;
+        closeOpenPacket(pipeline);
+        processPendingWrites(address);
 
-                    OrgBluezGattCharacteristic1* char_proxy = org_bluez_gatt_characteristic1_proxy_new_sync(
-                            g_dbus_proxy_get_connection(G_DBUS_PROXY(interface)),
-                            G_DBUS_PROXY_FLAGS_NONE,
-                            "org.bluez",
-                            g_dbus_proxy_get_object_path(G_DBUS_PROXY(interface)),
-                            nullptr,
-                            &error);
+        pipeline.coalescing = std::move(coalescing);
 
-                    if (error != nullptr)
-                    {
-                        LOG(fmt::format("Bluetooth - Failed to get D-Bus proxy for characteristic: {}", error->message));
-                        g_error_free(error);
-                    }
+        if (!pipeline.coalescing.append || pipeline.flushSource != nullptr)
+            return;
 
-                    GVariant* arg_value = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data.data(), data.size(), sizeof(gsl::byte));
+        // Ready-time source, unlike g_timeout_add() the deadline is not rounded to milliseconds
+        static GSourceFuncs flush_source_funcs{
+                nullptr, // prepare
+                nullptr, // check
+                [](GSource* source, GSourceFunc callback, gpointer user_data) -> gboolean
+                {
+                    g_source_set_ready_time(source, -1);
+                    return callback(user_data);
+                },
+                nullptr, // finalize
+                nullptr,
+                nullptr};
+
+        const auto on_flush_deadline = [](gpointer user_data) -> gboolean
+        {
+            auto* ctx = static_cast<SourceContext*>(user_data);
+            ctx->owner->flushOpenPacket(ctx->address);
 
-                    GVariantBuilder builder{};
-                    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
-                    g_variant_builder_add(&builder, "{sv}", "type", g_variant_new_string(withResponse ? "request" : "command"));
-                    GVariant* arg_options = g_variant_builder_end(&builder);
+            return G_SOURCE_CONTINUE;
+        };
 
-                    org_bluez_gatt_characteristic1_call_write_value(
-                            char_proxy,
-                            arg_value,
-                            arg_options,
-                            nullptr, // cancelable
-                            on_write_complete,
-                            this);
-                }
-            }
-        }
+        pipeline.flushSource = g_source_new(&flush_source_funcs, sizeof(GSource));
+        g_source_set_callback(
+                pipeline.flushSource,
+                on_flush_deadline,
+                new SourceContext{this, address},
+                [](gpointer user_data) { delete static_cast<SourceContext*>(user_data); });
+        g_source_attach(pipeline.flushSource, g_main_context_get_thread_default());
     }
 
-    //==================================================================================================================
-    void deviceConnected(OrgBluezDevice1* device, bool success)
+    void coalesceWrite(const juce::String&             address,
+                       WritePipeline&                  pipeline,
+                       const std::string&              objectPath,
+                       const CharacteristicCacheEntry& charact,
+                       gsl::span<const gsl::byte>      data)
     {
-        const juce::String address = bluez_utils::get_device_address(device);
+        const auto max_length = getMaximumValueLength(charact);
+        const auto result     = pipeline.packer.add(pipeline.coalescing.append, objectPath, data, max_length, [&pipeline](auto&& packet) { pipeline.queuePacket(std::move(packet)); });
 
-        if (!success)
-        {
-            LOG(fmt::format("Bluetooth - Failed to connect to device: {}", address));
+        if (result == WritePacker::Result::Oversized)
+            LOG(fmt::format("Bluetooth - Write of {} bytes doesn't fit a packet of {} bytes, sending it on its own", data.size(), max_length));
 
-            deviceDisconnected(device);
+        if (!pipeline.packer.isOpen())
+            g_source_set_ready_time(pipeline.flushSource, -1);
+        else if (result == WritePacker::Result::Opened)
+            g_source_set_ready_time(pipeline.flushSource, g_get_monotonic_time() + pipeline.coalescing.flushDeadlineUs);
+
+        processPendingWrites(address);
+    }
+
+    void closeOpenPacket(WritePipeline& pipeline)
+    {
+        if (!pipeline.packer.isOpen())
             return;
-        }
 
-        LOG(fmt::format("Bluetooth - Device connected: {}", address));
+        pipeline.packer.close([&pipeline](auto&& packet) { pipeline.queuePacket(std::move(packet)); });
+
+        g_source_set_ready_time(pipeline.flushSource, -1);
+    }
 
-        if (auto ch = valueTree.getChildWithProperty(ID::address, address); ch.isValid())
+    void flushOpenPacket(const juce::String& address)
+    {
+        if (const auto it = writePipelines.find(address); it != writePipelines.end())
         {
-            ch.removeProperty(ID::is_connected, nullptr);
-            ch.setProperty(ID::is_connected, true, nullptr);
-            ch.setProperty(ID::max_pdu_size, 20, nullptr); // TODO: How to know?
+            closeOpenPacket(it->second);
+            processPendingWrites(address);
         }
     }
 
-    void deviceDisconnected(OrgBluezDevice1* device)
+    [[nodiscard]] size_t getMaximumValueLength(const CharacteristicCacheEntry& charact) const
     {
-        const auto addr_str = bluez_utils::get_device_address(device);
+        if (charact.writeChannel != nullptr && charact.writeChannel->mtu > 0)
+            return charact.writeChannel->getMaximumValueLength();
 
-        LOG(fmt::format("Bluetooth - Device disconnected: {}", addr_str));
+        return getMaximumValueLength(charact.address);
+    }
 
-        if (const auto conn = connections.find(addr_str); conn != connections.end())
-        {
-            connections.erase(conn);
+    [[nodiscard]] size_t getMaximumValueLength(const juce::String& address) const
+    {
+        const auto it  = negotiatedMtu.find(address);
+        const auto mtu = it != negotiatedMtu.end() ? it->second : DefaultAttMtu;
 
-            clearCharacteristicCacheForDevice(addr_str);
-        }
+        return static_cast<size_t>(mtu - 3);
     }
 
-    void clearCharacteristicCacheForDevice(const juce::String& address)
+    // BlueZ doesn't expose the MTU on the device, it is learned from AcquireWrite/AcquireNotify and GattCharacteristic1.MTU
+    void mtuChanged(const juce::String& address, uint16_t mtu)
     {
-        if (auto dev = valueTree.getChildWithProperty(ID::address, address); dev.isValid())
+        if (mtu < DefaultAttMtu)
+            return;
+
+        if (auto [it, was_inserted] = negotiatedMtu.try_emplace(address, mtu); !was_inserted)
         {
-            for (const auto& srv: dev)
-            {
-                if (srv.hasType(ID::SERVICE))
-                {
-                    for (const auto& ch: srv)
-                    {
-                        if (ch.hasType(ID::CHARACTERISTIC))
-                        {
-                            const juce::String& object_path = ch.getProperty(ID::dbus_object_path);
-
-                            const auto it = std::find_if(characteristicCache.begin(), characteristicCache.end(), [&](const auto& ent)
-                                                         { return ent.dbusObjectPath.compare(object_path) == 0; });
-
-                            if (it != characteristicCache.end())
-                                characteristicCache.erase(it);
-                        }
-                    }
-                }
-            }
+            if (it->second == mtu)
+                return;
 
-            valueTree.removeChild(dev, nullptr);
+            it->second = mtu;
         }
+
+        LOG(fmt::format("Bluetooth - MTU of {}: {}", address, mtu));
+
+        runOnMessageThread([devices = deviceIndex, address, max_pdu_size = static_cast<int>(getMaximumValueLength(address))]
+                           {
+                               if (auto dev = devices->find(address); dev.isValid())
+                                   dev.setProperty(ID::max_pdu_size, max_pdu_size, nullptr);
+                           });
     }
-    void deviceDiscovered(std::string_view addr, std::string_view name, int16_t rssi, [[maybe_unused]] bool is_connected)
+
+    void processPendingWrites(const juce::String& address)
     {
-        const auto addr_str = bluez_utils::get_address_string(addr.data());
-        const auto name_str = juce::String(name.data());
+        const auto it = writePipelines.find(address);
 
-        const auto now = (int) juce::Time::getMillisecondCounter();
+        if (it == writePipelines.end())
+            return;
+
+        auto& pipeline = it->second;
 
-        if (auto ch = valueTree.getChildWithProperty(ID::address, addr_str); ch.isValid())
+        while (!pipeline.queue.empty())
         {
-            ch.setProperty(ID::rssi, rssi, nullptr);
-            if (name_str.isNotEmpty())
-                ch.setProperty(ID::name, name_str, nullptr);
+            auto& write = pipeline.queue.front();
+
+            auto&      in_flight     = write.withResponse ? pipeline.inFlightWithResponse : pipeline.inFlightWithoutResponse;
+            const auto max_in_flight = write.withResponse ? maxWritesInFlightWithResponse.load() : maxWritesInFlightWithoutResponse.load();
+
+            if (in_flight >= max_in_flight)
+                break;
 
-            ch.setProperty(ID::last_seen, now, nullptr);
+            const auto result = issueWrite(address, pipeline, write);
+
+            if (result == WriteResult::Blocked)
+                break;
+
+            if (result == WriteResult::InFlight)
+                ++in_flight;
+
+            pipeline.queue.pop_front();
         }
-        else
-        {
-            valueTree.appendChild({ID::BLUETOOTH_DEVICE, {{ID::name, name_str}, {ID::address, addr_str}, {ID::rssi, rssi}, {ID::is_connected, false}, {ID::last_seen, now}}}, nullptr);
+
+        pipeline.numPending.store(pipeline.queue.size() + pipeline.inFlightWithResponse + pipeline.inFlightWithoutResponse + (pipeline.packer.isOpen() ? 1 : 0),
+                                  std::memory_order_relaxed);
+    }
+
+    // Called from the message thread, the I/O thread only takes the lock when adding or removing pipelines
+    [[nodiscard]] size_t getNumPendingWrites(const juce::String& address) const
+    {
+        const juce::ScopedLock lock(writePipelinesLock);
+
+        if (const auto it = writePipelines.find(address); it != writePipelines.end())
+            return it->second.numPending.load(std::memory_order_relaxed);
+
+        return 0;
+    }
+
+    WriteResult issueWrite(const juce::String& address, const WritePipeline& pipeline, const PendingWrite& write)
+    {
+        const auto it = characteristicCache.find(write.objectPath);
+
+        // The characteristic went away (e.g. re-discovery) after the write was queued
+        if (it == characteristicCache.end())
+            return WriteResult::Done;
+
+        auto& [object_path, charact] = *it;
+
+        const auto data = gsl::span<const gsl::byte>(write.data.data(), write.data.size());
+
+        // Writes without response use the socket unless BlueZ refused to hand one out, then they all go through D-Bus
+        if (!write.withResponse)
+        {
+            if (charact.writeChannel == nullptr)
+            {
+                charact.writeChannel = std::make_unique<WriteChannel>(*this, juce::String(object_path));
+                acquireWriteChannel(charact);
+            }
+
+            if (!charact.writeChannel->isUnsupported)
+                return sendOnWriteChannel(pipeline, object_path, charact, data);
+        }
+
+        const auto on_write_complete = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
+        {
+            GError* err = nullptr;
+
+            OrgBluezGattCharacteristic1* proxy = ORG_BLUEZ_GATT_CHARACTERISTIC1(source_object);
+            auto                         op    = std::unique_ptr<WriteOperation>(static_cast<WriteOperation*>(user_data));
+            auto*                        p     = op->owner;
+
+            const char* path    = g_dbus_proxy_get_object_path(G_DBUS_PROXY(proxy));
+            const bool  success = org_bluez_gatt_characteristic1_call_write_value_finish(proxy, res, &err);
+
+            if (!success)
+            {
+                LOG(fmt::format("Bluetooth - Error writing characteristic: {} - {}\n", path, err->message));
+
+                g_error_free(err);
+            }
+
+            // Note: A reply for a pipeline that was torn down (and maybe recreated) in the meantime must not free a slot
+            const auto pit = p->writePipelines.find(op->address);
+
+            if (pit == p->writePipelines.end() || pit->second.id != op->pipelineId)
+                return;
+
+            auto& in_flight = op->withResponse ? pit->second.inFlightWithResponse : pit->second.inFlightWithoutResponse;
+            jassert(in_flight > 0);
+            --in_flight;
+
+            if (const auto iit = p->characteristicCache.find(std::string_view(path)); iit != p->characteristicCache.end())
+                if (const auto* callbacks = iit->second.callbacks; callbacks != nullptr && callbacks->characteristicWritten)
+                    callbacks->characteristicWritten(iit->second.uuid, success);
+
+            p->processPendingWrites(op->address);
+        };
+
+        GVariant* arg_value = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data.data(), data.size(), sizeof(gsl::byte));
+
+        GVariantBuilder builder{};
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&builder, "{sv}", "type", g_variant_new_string(write.withResponse ? "request" : "command"));
+        GVariant* arg_options = g_variant_builder_end(&builder);
+
+        org_bluez_gatt_characteristic1_call_write_value(
+                charact.characteristicProxy.get(),
+                arg_value,
+                arg_options,
+                nullptr, // cancelable
+                on_write_complete,
+                new WriteOperation{this, address, pipeline.id, write.withResponse});
+
+        return WriteResult::InFlight;
+    }
+
+    // Reports a write that went out on the socket from the main loop, like a WriteValue reply, so the callback can't
+    // re-enter processPendingWrites()
+    void characteristicWrittenOnSocket(const std::string& object_path, bool success)
+    {
+        const auto on_written = [](gpointer user_data) -> gboolean
+        {
+            auto* op = static_cast<SocketWriteOperation*>(user_data);
+
+            if (const auto it = op->owner->characteristicCache.find(op->objectPath); it != op->owner->characteristicCache.end())
+                if (const auto* callbacks = it->second.callbacks; callbacks != nullptr && callbacks->characteristicWritten)
+                    callbacks->characteristicWritten(it->second.uuid, op->success);
+
+            return G_SOURCE_REMOVE;
+        };
+
+        GSource* source = g_idle_source_new();
+        g_source_set_callback(
+                source,
+                on_written,
+                new SocketWriteOperation{this, object_path, success},
+                [](gpointer user_data) { delete static_cast<SocketWriteOperation*>(user_data); });
+        g_source_attach(source, g_main_context_get_thread_default());
+        g_source_unref(source);
+    }
+
+    // BlueZ doesn't order the socket against WriteValue calls, so a characteristic never mixes the two. Writes wait
+    // while the socket is being (re-)acquired, while earlier writes without response are still in flight on D-Bus
+    // and while the socket buffer is full.
+    WriteResult sendOnWriteChannel(const WritePipeline& pipeline, const std::string& object_path, CharacteristicCacheEntry& charact, gsl::span<const gsl::byte> data)
+    {
+        auto& channel = *charact.writeChannel;
+
+        if (channel.fd < 0 || pipeline.inFlightWithoutResponse > 0)
+            return WriteResult::Blocked;
+
+        // An ATT Write Command can't be longer, WriteValue would reject it just the same
+        if (data.size() > channel.getMaximumValueLength())
+        {
+            LOG(fmt::format("Bluetooth - Write of {} bytes exceeds the maximum of {} bytes: {}", data.size(), channel.getMaximumValueLength(), object_path));
+
+            characteristicWrittenOnSocket(object_path, false);
+            return WriteResult::Done;
+        }
+
+        const auto len = send(channel.fd, data.data(), data.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (len == static_cast<ssize_t>(data.size()))
+        {
+            characteristicWrittenOnSocket(object_path, true);
+            return WriteResult::Done;
+        }
+
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            channel.waitUntilWritable();
+            return WriteResult::Blocked;
+        }
+
+        // The write stays queued and goes out on the new socket
+        LOG(fmt::format("Bluetooth - Write socket failed: {} - {}", channel.dbusObjectPath, strerror(errno)));
+        acquireWriteChannel(charact);
+
+        return WriteResult::Blocked;
+    }
+
+    void acquireWriteChannel(CharacteristicCacheEntry& charact)
+    {
+        jassert(charact.writeChannel != nullptr);
+
+        // One AcquireWrite at a time, and none once BlueZ said the characteristic doesn't support it
+        if (charact.writeChannel->isAcquiring || charact.writeChannel->isUnsupported)
+            return;
+
+        charact.writeChannel->release();
+        charact.writeChannel->isAcquiring = true;
+
+        const auto on_write_acquired = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
+        {
+            GError*      err      = nullptr;
+            gint         fd_index = -1;
+            guint16      mtu      = 0;
+            GUnixFDList* fd_list  = nullptr;
+
+            OrgBluezGattCharacteristic1* proxy = ORG_BLUEZ_GATT_CHARACTERISTIC1(source_object);
+            auto*                        p     = reinterpret_cast<BleAdapter::Impl*>(user_data);
+
+            const bool success = org_bluez_gatt_characteristic1_call_acquire_write_finish(proxy, &fd_index, &mtu, &fd_list, res, &err);
+
+            // The channel might have been released (e.g. the device disconnected) while we were waiting
+            const auto it      = p->characteristicCache.find(std::string_view(g_dbus_proxy_get_object_path(G_DBUS_PROXY(proxy))));
+            auto*      channel = it != p->characteristicCache.end() ? it->second.writeChannel.get() : nullptr;
+
+            int fd = -1;
+
+            if (success)
+            {
+                fd = bluez_utils::get_fd_from_list(fd_list, fd_index);
+                g_object_unref(fd_list);
+            }
+            else
+            {
+                LOG(fmt::format("Bluetooth - Error acquiring write socket, falling back to WriteValue: {}\n", err->message));
+                g_error_free(err);
+            }
+
+            if (channel == nullptr)
+            {
+                if (fd >= 0)
+                    close(fd);
+
+                return;
+            }
+
+            if (fd >= 0)
+            {
+                channel->acquired(fd, mtu);
+                p->mtuChanged(it->second.address, mtu);
+            }
+            else
+            {
+                channel->isAcquiring   = false;
+                channel->isUnsupported = true;
+            }
+
+            // Writes held back for the socket go out now, through D-Bus if there is none
+            p->processPendingWrites(it->second.address);
+        };
+
+        org_bluez_gatt_characteristic1_call_acquire_write(
+                charact.characteristicProxy.get(),
+                g_variant_new("a{sv}", nullptr),
+                nullptr, // fd_list
+                nullptr, // cancelable
+                on_write_acquired,
+                this);
+    }
+
+    void writeChannelLost(const juce::String& object_path)
+    {
+        LOG(fmt::format("Bluetooth - Write socket released, reacquiring: {}", object_path));
+
+        if (const auto it = characteristicCache.find(to_string_view(object_path)); it != characteristicCache.end() && it->second.writeChannel != nullptr)
+            acquireWriteChannel(it->second);
+    }
+
+    void writeChannelWritable(const juce::String& object_path)
+    {
+        if (const auto it = characteristicCache.find(to_string_view(object_path)); it != characteristicCache.end())
+            processPendingWrites(it->second.address);
+    }
+
+    //==================================================================================================================
+    void deviceConnected(OrgBluezDevice1* device, bool success)
+    {
+        const juce::String address = bluez_utils::get_device_address(device);
+
+        if (!success)
+        {
+            LOG(fmt::format("Bluetooth - Failed to connect to device: {}", address));
+
+            deviceDisconnected(address);
+            return;
+        }
+
+        LOG(fmt::format("Bluetooth - Device connected: {}", address));
+
+        // Restored when the device connected already, unless it was connected before we started
+        restoreGattDatabase(address);
+        validateGattDatabase(address);
+        rememberDevice(device);
+
+        runOnMessageThread([devices = deviceIndex, address, max_pdu_size = static_cast<int>(getMaximumValueLength(address))]
+                           {
+                               if (auto ch = devices->find(address); ch.isValid())
+                               {
+                                   ch.removeProperty(ID::is_connected, nullptr);
+                                   ch.setProperty(ID::is_connected, true, nullptr);
+                                   ch.setProperty(ID::max_pdu_size, max_pdu_size, nullptr);
+                               }
+                           });
+    }
+
+    // Only devices connected through us are remembered
+    void rememberDevice(OrgBluezDevice1* device)
+    {
+        const auto address = bluez_utils::get_device_address(device);
+
+        if (connections.find(address) == connections.end())
+            return;
+
+        KnownDevices::Device known{address, org_bluez_device1_get_name(device), org_bluez_device1_get_address_type(device), {}, juce::Time::currentTimeMillis()};
+
+        if (const gchar* const* uuids = org_bluez_device1_get_uuids(device))
+            for (auto* uuid = uuids; *uuid != nullptr; ++uuid)
+                known.services.add(*uuid);
+
+        // Written from the message thread, see BleAdapter::timerCallback()
+        knownDevices.remember(std::move(known));
+    }
+
+    //==================================================================================================================
+    // Database being recorded for the GATT cache, nullptr if the cache is off or the device isn't ours
+    GattDatabase* findGattDatabase(const juce::String& address)
+    {
+        if (!gattCache.isEnabled() || connections.find(address) == connections.end())
+            return nullptr;
+
+        return &gattDatabases[address].database;
+    }
+
+    void saveGattDatabase(const juce::String& address)
+    {
+        if (const auto it = gattDatabases.find(address); it != gattDatabases.end())
+        {
+            if (!it->second.database.services.empty() && !gattCache.save(address, it->second.database))
+                LOG(fmt::format("Bluetooth - Failed to write GATT cache for {}", address));
+
+            gattDatabases.erase(it);
+        }
+    }
+
+    // Publishes the SERVICE and CHARACTERISTIC nodes of a cached database and sets up their cache entries as soon as
+    // the device is connected, while BlueZ is still resolving its services. The database is checked against the device
+    // once they are resolved, see validateGattDatabase().
+    void restoreGattDatabase(const juce::String& address)
+    {
+        auto* db = findGattDatabase(address);
+
+        if (db == nullptr || !db->services.empty())
+            return;
+
+        auto cached = gattCache.load(address);
+
+        if (!cached.has_value())
+            return;
+
+        LOG(fmt::format("Bluetooth - Restoring GATT database from cache: {}", address));
+
+        *db                               = std::move(*cached);
+        gattDatabases[address].isRestored = true;
+
+        const auto restored = db->toValueTree([&](const GattDatabase::Characteristic& c, const juce::ValueTree& charact)
+                                              { characteristicDiscovered(address, juce::String(c.path), c.uuid, charact); });
+
+        runOnMessageThread([owner = weakThis, devices = deviceIndex, address, restored]
+                           {
+                               if (auto dev = devices->find(address); dev.isValid())
+                                   mergeDiscovered(owner, dev, restored);
+                           });
+    }
+
+    // Services and characteristics of the device as BlueZ exports them right now
+    GattDatabase readGattLayout(const juce::String& address)
+    {
+        GattDatabase current;
+
+        const juce::String device_path = bluez_utils::get_device_object_path_from_address(bluezAdapter, address);
+
+        const auto get_uuid = [this](const std::string& path, const char* interface_name)
+        {
+            return bluez_utils::get_object_uuid(dbusObjectManager, path.c_str(), interface_name);
+        };
+
+        for (const auto& service_path: objectIndex.getChildren(to_string_view(device_path)))
+        {
+            if (const auto service_uuid = get_uuid(service_path, "org.bluez.GattService1"))
+            {
+                current.addService(service_path, *service_uuid);
+
+                for (const auto& charact_path: objectIndex.getChildren(service_path))
+                    if (const auto charact_uuid = get_uuid(charact_path, "org.bluez.GattCharacteristic1"))
+                        current.addCharacteristic(charact_path, *charact_uuid);
+            }
+        }
+
+        return current;
+    }
+
+    // Reads the Database Hash once BlueZ has resolved the services, see databaseHashRead()
+    void validateGattDatabase(const juce::String& address)
+    {
+        if (findGattDatabase(address) == nullptr)
+            return;
+
+        std::optional<std::string> hash_path;
+
+        for (const auto& s: readGattLayout(address).services)
+            for (const auto& c: s.characteristics)
+                if (c.uuid == GattDatabase::getDatabaseHashUuid())
+                    hash_path = c.path;
+
+        // Note: The call keeps its own reference to the proxy
+        const auto proxy = hash_path.has_value() ? bluez_utils::get_characteristic_proxy(dbusObjectManager, juce::String(*hash_path))
+                                                 : CharacteristicProxy(nullptr, g_object_unref);
+
+        if (proxy == nullptr)
+        {
+            databaseHashRead(address, {});
+            return;
+        }
+
+        const auto on_read_complete = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
+        {
+            const auto ctx = std::unique_ptr<SourceContext>(static_cast<SourceContext*>(user_data));
+
+            GError*   err   = nullptr;
+            GVariant* value = nullptr;
+
+            if (!org_bluez_gatt_characteristic1_call_read_value_finish(ORG_BLUEZ_GATT_CHARACTERISTIC1(source_object), &value, res, &err))
+            {
+                LOG(fmt::format("Bluetooth - Error reading Database Hash: {} - {}", ctx->address, err->message));
+                g_error_free(err);
+
+                ctx->owner->databaseHashRead(ctx->address, {});
+                return;
+            }
+
+            gsize       data_len = 0;
+            const auto* data     = g_variant_get_fixed_array(value, &data_len, sizeof(uint8_t));
+
+            ctx->owner->databaseHashRead(ctx->address, juce::MemoryBlock(data, data_len));
+
+            g_variant_unref(value);
+        };
+
+        org_bluez_gatt_characteristic1_call_read_value(
+                proxy.get(),
+                g_variant_new("a{sv}", nullptr),
+                nullptr, // cancelable
+                on_read_complete,
+                new SourceContext{this, address});
+    }
+
+    // Freshly discovered databases record the hash for the next connection, empty if the device has none or it couldn't
+    // be read. A restored database is kept and subscribed again if the hash is still the same, devices without one can
+    // only be compared by layout. Otherwise the cached database is dropped and the device discovered again.
+    void databaseHashRead(const juce::String& address, juce::MemoryBlock hash)
+    {
+        const auto it = gattDatabases.find(address);
+
+        // Disconnected in the meantime
+        if (it == gattDatabases.end() || connections.find(address) == connections.end())
+            return;
+
+        auto& [db, is_restored] = it->second;
+
+        if (!is_restored)
+        {
+            db.databaseHash = std::move(hash);
+            return;
+        }
+
+        is_restored = false;
+
+        const bool is_current = hash.isEmpty() && db.databaseHash.isEmpty()
+                                        ? db.isCompatibleWith(readGattLayout(address))
+                                        : hash == db.databaseHash;
+
+        if (is_current)
+        {
+            for (const auto& s: db.services)
+                for (const auto& c: s.characteristics)
+                    if (c.notify)
+                        enableNotifications(c.path, c.acquire);
+
+            return;
+        }
+
+        LOG(fmt::format("Bluetooth - GATT cache out of date, discovering again: {}", address));
+
+        gattCache.remove(address);
+
+        db              = {};
+        db.databaseHash = std::move(hash);
+
+        if (const auto cit = characteristicsByDevice.find(address); cit != characteristicsByDevice.end())
+        {
+            for (const auto& object_path: cit->second)
+            {
+                characteristicCache.erase(object_path);
+                descriptorCache.erase(object_path);
+            }
+
+            characteristicsByDevice.erase(cit);
+        }
+
+        runOnMessageThread([devices = deviceIndex, address]
+                           {
+                               if (auto dev = devices->find(address); dev.isValid())
+                               {
+                                   for (int i = dev.getNumChildren(); --i >= 0;)
+                                       if (dev.getChild(i).hasType(ID::SERVICE))
+                                           dev.removeChild(i, nullptr);
+
+                                   genki::message(dev, ID::DISCOVER_SERVICES);
+                               }
+                           });
+    }
+
+    void deviceDisconnected(const juce::String& addr_str)
+    {
+        LOG(fmt::format("Bluetooth - Device disconnected: {}", addr_str));
+
+        if (const auto conn = connections.find(addr_str); conn != connections.end())
+        {
+            connections.erase(conn);
+
+            releaseDevice(addr_str);
+            return;
+        }
+
+        // Connected by someone else, its node stays and expires like any other device. Its GATT objects go away with
+        // the connection, there is no database of ours to save.
+        clearCharacteristicCacheForDevice(addr_str);
+
+        runOnMessageThread([devices = deviceIndex, addr_str]
+                           {
+                               if (auto ch = devices->find(addr_str); ch.isValid() && ch.getProperty(ID::is_connected))
+                               {
+                                   ch.setProperty(ID::is_connected, false, nullptr);
+                                   ch.setProperty(ID::last_seen, (int) juce::Time::getMillisecondCounter(), nullptr);
+                               }
+                           });
+    }
+
+    void trackObjectPath(const juce::String& address, std::string object_path)
+    {
+        auto& paths = characteristicsByDevice[address];
+
+        if (std::find(paths.begin(), paths.end(), object_path) == paths.end())
+            paths.push_back(std::move(object_path));
+    }
+
+    void characteristicDiscovered(const juce::String& address, const juce::String& object_path, const juce::Uuid& uuid, const juce::ValueTree& charactState)
+    {
+        auto proxy = bluez_utils::get_characteristic_proxy(dbusObjectManager, object_path);
+
+        if (proxy == nullptr)
+            return;
+
+        const auto  conn      = connections.find(address);
+        const auto* callbacks = conn != connections.end() ? &conn->second.second : nullptr;
+
+        // Discovered again, e.g. after being restored from the GATT cache. The entry and its sockets stay as they are.
+        if (const auto it = characteristicCache.find(to_string_view(object_path)); it != characteristicCache.end() && it->second.address == address)
+            return;
+
+        characteristicCache.erase(object_path.toStdString());
+        characteristicCache.try_emplace(object_path.toStdString(), *this, std::move(proxy), address, uuid, callbacks, charactState);
+
+        trackObjectPath(address, object_path.toStdString());
+    }
+
+    auto findCharacteristic(const juce::String& address, const juce::Uuid& uuid) -> ObjectPathMap<CharacteristicCacheEntry>::iterator
+    {
+        if (const auto it = characteristicsByDevice.find(address); it != characteristicsByDevice.end())
+            for (const auto& object_path: it->second)
+                if (const auto iit = characteristicCache.find(object_path); iit != characteristicCache.end() && iit->second.uuid == uuid)
+                    return iit;
+
+        return characteristicCache.end();
+    }
+
+    void descriptorDiscovered(const juce::String& address, const std::string& object_path, const juce::Uuid& uuid, const juce::Uuid& charactUuid, const juce::ValueTree& descriptorState)
+    {
+        // Discovered again, the entry stays as it is
+        if (const auto it = descriptorCache.find(object_path); it != descriptorCache.end() && it->second.address == address)
+            return;
+
+        auto proxy = bluez_utils::get_descriptor_proxy(dbusObjectManager, juce::String(object_path));
+
+        if (proxy == nullptr)
+            return;
+
+        const auto  conn      = connections.find(address);
+        const auto* callbacks = conn != connections.end() ? &conn->second.second : nullptr;
+
+        descriptorCache.insert_or_assign(object_path, DescriptorCacheEntry{std::move(proxy), address, uuid, charactUuid, callbacks, descriptorState});
+
+        trackObjectPath(address, object_path);
+    }
+
+    auto findDescriptor(const juce::String& address, const juce::Uuid& charactUuid, const juce::Uuid& uuid) -> ObjectPathMap<DescriptorCacheEntry>::iterator
+    {
+        if (const auto it = characteristicsByDevice.find(address); it != characteristicsByDevice.end())
+            for (const auto& object_path: it->second)
+                if (const auto iit = descriptorCache.find(object_path); iit != descriptorCache.end() && iit->second.uuid == uuid && iit->second.characteristicUuid == charactUuid)
+                    return iit;
+
+        return descriptorCache.end();
+    }
+
+    // Our connection to the device is over: its GATT database goes to the cache and its node is removed
+    void releaseDevice(const juce::String& address)
+    {
+        saveGattDatabase(address);
+        clearCharacteristicCacheForDevice(address);
+
+        runOnMessageThread([vt = valueTree, devices = deviceIndex, address]() mutable
+                           {
+                               if (auto dev = devices->find(address); dev.isValid())
+                                   vt.removeChild(dev, nullptr);
+                           });
+    }
+
+    void clearCharacteristicCacheForDevice(const juce::String& address)
+    {
+        if (const auto it = characteristicsByDevice.find(address); it != characteristicsByDevice.end())
+        {
+            for (const auto& object_path: it->second)
+            {
+                characteristicCache.erase(object_path);
+                descriptorCache.erase(object_path);
+            }
+
+            characteristicsByDevice.erase(it);
+        }
+
+        negotiatedMtu.erase(address);
+
+        // Queued writes are dropped, replies still in flight are ignored
+        {
+            const juce::ScopedLock lock(writePipelinesLock);
+            writePipelines.erase(address);
+        }
+    }
+
+    void deviceDiscovered(std::string_view addr, std::string_view name, int16_t rssi, bool is_connected)
+    {
+        // Devices that are neither connected nor promoted stay in the registry, without a node
+        if (compactScanning && !registry.update(DeviceRegistry::toKey(addr), name.data(), rssi, (int) juce::Time::getMillisecondCounter(), is_connected))
+            return;
+
+        const auto addr_str = bluez_utils::get_address_string(addr.data());
+        const auto name_str = juce::String(name.data());
+
+        runOnMessageThread([vt = valueTree, devices = deviceIndex, throttle = advertisements, addr_str, name_str, rssi, is_connected]() mutable
+                           {
+                               const auto now = (int) juce::Time::getMillisecondCounter();
+
+                               if (auto ch = devices->find(addr_str); ch.isValid())
+                               {
+                                   throttle->deviceSeen(ch, addr_str, rssi, name_str, now);
+                               }
+                               else
+                               {
+                                   vt.appendChild({ID::BLUETOOTH_DEVICE, {{ID::name, name_str}, {ID::address, addr_str}, {ID::rssi, rssi}, {ID::is_connected, is_connected}, {ID::last_seen, now}}}, nullptr);
+                               }
+                           });
+    }
+
+    // Encodes the advertisement fields cached on the Device1 proxy into advertisementRecord, which is reused so that
+    // only the copy posted to the device state allocates
+    void advertisementChanged(const char* addr, GDBusProxy* device_proxy)
+    {
+        encodeAdvertisement(device_proxy);
+
+        const auto addr_str = bluez_utils::get_address_string(addr);
+
+        if (advertisementCallback)
+            advertisementCallback(addr_str, AdvertisementData(advertisementRecord));
+
+        // Devices without a node keep their record in the registry until promoted
+        if (compactScanning && registry.keepAdvertisement(DeviceRegistry::toKey(std::string_view(addr)), advertisementRecord.data(), advertisementRecord.size()))
+            return;
+
+        runOnMessageThread([devices = deviceIndex, throttle = advertisements, addr_str, block = juce::MemoryBlock(advertisementRecord.data(), advertisementRecord.size())]() mutable
+                           {
+                               if (auto dev = devices->find(addr_str); dev.isValid())
+                                   throttle->advertisementChanged(dev, addr_str, std::move(block), (int) juce::Time::getMillisecondCounter());
+                           });
+    }
+
+    void encodeAdvertisement(GDBusProxy* device_proxy)
+    {
+        advertisementRecord.clear();
+
+        if (GVariant* uuids = g_dbus_proxy_get_cached_property(device_proxy, "UUIDs"))
+        {
+            // As many as fit into one AD structure
+            std::array<gsl::byte, 15 * 16> uuid_bytes{};
+            size_t                         num_uuids = 0;
+
+            GVariantIter iter;
+            const gchar* uuid = nullptr;
+
+            g_variant_iter_init(&iter, uuids);
+
+            while (num_uuids < 15 && g_variant_iter_next(&iter, "&s", &uuid))
+                if (AdvertisementData::parseUuid(uuid, gsl::span<gsl::byte, 16>(uuid_bytes.data() + num_uuids * 16, 16)))
+                    ++num_uuids;
+
+            if (num_uuids > 0)
+                AdvertisementData::append(advertisementRecord, AdvertisementData::ServiceUuids, {gsl::span<const gsl::byte>(uuid_bytes.data(), num_uuids * 16)});
+
+            g_variant_unref(uuids);
+        }
+
+        if (GVariant* tx_power = g_dbus_proxy_get_cached_property(device_proxy, "TxPower"))
+        {
+            const auto power = static_cast<gsl::byte>(static_cast<int8_t>(g_variant_get_int16(tx_power)));
+
+            AdvertisementData::append(advertisementRecord, AdvertisementData::TxPowerLevel, {gsl::span<const gsl::byte>(&power, 1)});
+
+            g_variant_unref(tx_power);
+        }
+
+        if (GVariant* service_data = g_dbus_proxy_get_cached_property(device_proxy, "ServiceData"))
+        {
+            GVariantIter iter;
+            const gchar* uuid  = nullptr;
+            GVariant*    value = nullptr;
+
+            g_variant_iter_init(&iter, service_data);
+
+            while (g_variant_iter_next(&iter, "{&sv}", &uuid, &value))
+            {
+                std::array<gsl::byte, 16> uuid_bytes{};
+                gsize                     data_len = 0;
+                const auto*               data     = static_cast<const gsl::byte*>(g_variant_get_fixed_array(value, &data_len, sizeof(uint8_t)));
+
+                if (AdvertisementData::parseUuid(uuid, uuid_bytes))
+                    AdvertisementData::append(advertisementRecord, AdvertisementData::ServiceData, {uuid_bytes, gsl::span(data, data_len)});
+
+                g_variant_unref(value);
+            }
+
+            g_variant_unref(service_data);
+        }
+
+        if (GVariant* manufacturer_data = g_dbus_proxy_get_cached_property(device_proxy, "ManufacturerData"))
+        {
+            GVariantIter iter;
+            guint16      company_id = 0;
+            GVariant*    value      = nullptr;
+
+            g_variant_iter_init(&iter, manufacturer_data);
+
+            while (g_variant_iter_next(&iter, "{qv}", &company_id, &value))
+            {
+                const std::array<gsl::byte, 2> company_bytes{static_cast<gsl::byte>(company_id & 0xff), static_cast<gsl::byte>(company_id >> 8)};
+
+                gsize       data_len = 0;
+                const auto* data     = static_cast<const gsl::byte*>(g_variant_get_fixed_array(value, &data_len, sizeof(uint8_t)));
+
+                AdvertisementData::append(advertisementRecord, AdvertisementData::ManufacturerSpecific, {company_bytes, gsl::span(data, data_len)});
+
+                g_variant_unref(value);
+            }
+
+            g_variant_unref(manufacturer_data);
+        }
+    }
+
+    // Notifications of the characteristic are flowing, through the socket or as PropertiesChanged signals
+    void notificationsEnabled(const CharacteristicCacheEntry& charact, const NotifyChannel& channel)
+    {
+        if (channel.getState() == NotifyChannel::State::Socket)
+            mtuChanged(charact.address, static_cast<uint16_t>(channel.getMtu()));
+
+        runOnMessageThread([state = charact.state] { genki::message(state, {ID::NOTIFICATIONS_ARE_ENABLED, {}}); });
+    }
+
+    NotifyChannel* findNotifyChannel(std::string_view object_path)
+    {
+        const auto it = characteristicCache.find(object_path);
+        return it != characteristicCache.end() ? it->second.notifyChannel.get() : nullptr;
+    }
+
+    void characteristicValueChanged(std::string_view object_path, gsl::span<const gsl::byte> data)
+    {
+        if (const auto it = characteristicCache.find(object_path); it != characteristicCache.end())
+            deliverValue(it->second, data);
+    }
+
+    void deliverValue(const CharacteristicCacheEntry& charact, gsl::span<const gsl::byte> data)
+    {
+        if (const auto& ring = charact.notificationRing; ring != nullptr)
+            if (ring->offer(data))
+                return;
+
+        if (charact.callbacks != nullptr && charact.callbacks->valueChanged)
+            charact.callbacks->valueChanged(charact.uuid, data);
+    }
+
+    void setNotificationRing(const juce::String& address, const juce::Uuid& uuid, std::shared_ptr<NotificationRing> ring)
+    {
+        const auto it = findCharacteristic(address, uuid);
+
+        if (it == characteristicCache.end())
+        {
+            LOG(fmt::format("Bluetooth - Characteristic not discovered: {}", uuid.toDashedString()));
+            return;
+        }
+
+        it->second.notificationRing = std::move(ring);
+    }
+
+    void readDescriptor(std::string_view object_path)
+    {
+        const auto it = descriptorCache.find(object_path);
+
+        if (it == descriptorCache.end())
+        {
+            LOG(fmt::format("Bluetooth - Descriptor not discovered: {}", object_path));
+            return;
+        }
+
+        const auto on_read_complete = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
+        {
+            auto*                    p     = reinterpret_cast<BleAdapter::Impl*>(user_data);
+            OrgBluezGattDescriptor1* proxy = ORG_BLUEZ_GATT_DESCRIPTOR1(source_object);
+
+            GError*     err   = nullptr;
+            GVariant*   value = nullptr;
+            const char* path  = g_dbus_proxy_get_object_path(G_DBUS_PROXY(proxy));
+
+            if (!org_bluez_gatt_descriptor1_call_read_value_finish(proxy, &value, res, &err))
+            {
+                LOG(fmt::format("Bluetooth - Error reading descriptor: {} - {}\n", path, err->message));
+
+                g_error_free(err);
+                return;
+            }
+
+            gsize       data_len = 0;
+            const auto* data     = static_cast<const uint8_t*>(g_variant_get_fixed_array(value, &data_len, sizeof(uint8_t)));
+
+            p->descriptorRead(std::string_view(path), gsl::as_bytes(gsl::span(data, static_cast<size_t>(data_len))));
+
+            g_variant_unref(value);
+        };
+
+        org_bluez_gatt_descriptor1_call_read_value(
+                it->second.descriptorProxy.get(),
+                g_variant_new("a{sv}", nullptr),
+                nullptr, // cancelable
+                on_read_complete,
+                this);
+    }
+
+    void descriptorRead(std::string_view object_path, gsl::span<const gsl::byte> data)
+    {
+        const auto it = descriptorCache.find(object_path);
+
+        if (it == descriptorCache.end())
+            return;
+
+        const auto& descriptor = it->second;
+
+        if (descriptor.callbacks != nullptr && descriptor.callbacks->descriptorRead)
+            descriptor.callbacks->descriptorRead(descriptor.characteristicUuid, descriptor.uuid, data);
+
+        runOnMessageThread([state = descriptor.state, block = juce::MemoryBlock(data.data(), data.size())]() mutable
+                           { state.setProperty(ID::value, block, nullptr); });
+    }
+
+    void writeDescriptor(std::string_view object_path, gsl::span<const gsl::byte> data)
+    {
+        const auto it = descriptorCache.find(object_path);
+
+        if (it == descriptorCache.end())
+        {
+            LOG(fmt::format("Bluetooth - Descriptor not discovered: {}", object_path));
+            return;
+        }
+
+        const auto on_write_complete = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
+        {
+            auto*                    p     = reinterpret_cast<BleAdapter::Impl*>(user_data);
+            OrgBluezGattDescriptor1* proxy = ORG_BLUEZ_GATT_DESCRIPTOR1(source_object);
+
+            GError*     err     = nullptr;
+            const char* path    = g_dbus_proxy_get_object_path(G_DBUS_PROXY(proxy));
+            const bool  success = org_bluez_gatt_descriptor1_call_write_value_finish(proxy, res, &err);
+
+            if (!success)
+            {
+                LOG(fmt::format("Bluetooth - Error writing descriptor: {} - {}\n", path, err->message));
+
+                g_error_free(err);
+            }
+
+            if (const auto iit = p->descriptorCache.find(std::string_view(path)); iit != p->descriptorCache.end())
+                if (const auto* callbacks = iit->second.callbacks; callbacks != nullptr && callbacks->descriptorWritten)
+                    callbacks->descriptorWritten(iit->second.characteristicUuid, iit->second.uuid, success);
+        };
+
+        org_bluez_gatt_descriptor1_call_write_value(
+                it->second.descriptorProxy.get(),
+                g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data.data(), data.size(), sizeof(gsl::byte)),
+                g_variant_new("a{sv}", nullptr),
+                nullptr, // cancelable
+                on_write_complete,
+                this);
+    }
+
+    //==================================================================================================================
+    // Commands from the typed API and the ValueTree messages alike, called on the message thread
+    void requestServiceDiscovery(const juce::ValueTree& device)
+    {
+        jassert(device.hasType(ID::BLUETOOTH_DEVICE));
+
+        runOnIoThread([this, deviceState = device, address = device.getProperty(ID::address).toString()]
+                      { discoverServices(address, deviceState); });
+    }
+
+    void requestFullDiscovery(const juce::ValueTree& device)
+    {
+        jassert(device.hasType(ID::BLUETOOTH_DEVICE));
+
+        runOnIoThread([this, deviceState = device, address = device.getProperty(ID::address).toString()]
+                      { discoverAll(address, deviceState); });
+    }
+
+    void requestCharacteristicDiscovery(const juce::ValueTree& service)
+    {
+        const auto device = getAncestor(service, ID::BLUETOOTH_DEVICE);
+        jassert(device.isValid());
+        jassert(service.hasType(ID::SERVICE));
+
+        runOnIoThread([this, service, address = device.getProperty(ID::address).toString(), service_path = service.getProperty(ID::dbus_object_path).toString()]
+                      { discoverCharacteristics(address, service_path, service); });
+    }
+
+    void requestScan(bool shouldStart, juce::StringArray uuids, AdvertisementThrottle::Policy policy)
+    {
+        if (shouldStart)
+            advertisements->setPolicy(policy);
+
+        runOnIoThread([this, shouldStart, uuids = std::move(uuids)] { scan(shouldStart, uuids); });
+    }
+
+    //==================================================================================================================
+    void valueTreeChildAdded(ValueTree& parent, ValueTree& child) override
+    {
+        if (child.hasType(ID::DISCOVER_SERVICES))
+        {
+            requestServiceDiscovery(parent);
+        }
+        else if (child.hasType(ID::DISCOVER_ALL))
+        {
+            requestFullDiscovery(parent);
+        }
+        else if (child.hasType(ID::DISCOVER_CHARACTERISTICS))
+        {
+            requestCharacteristicDiscovery(parent);
+        }
+        else if (child.hasType(ID::ENABLE_NOTIFICATIONS) || child.hasType(ID::ENABLE_INDICATIONS))
+        {
+            jassert(parent.hasType(ID::CHARACTERISTIC));
+
+            runOnIoThread([this, object_path = parent.getProperty(ID::dbus_object_path).toString(), acquire = static_cast<bool>(child.getProperty(ID::acquire))]
+                          { enableNotifications(to_string_view(object_path), acquire); });
+        }
+        else if (child.hasType(ID::READ_DESCRIPTOR))
+        {
+            jassert(parent.hasType(ID::DESCRIPTOR));
+
+            runOnIoThread([this, object_path = parent.getProperty(ID::dbus_object_path).toString()]
+                          { readDescriptor(to_string_view(object_path)); });
+        }
+        else if (child.hasType(ID::WRITE_DESCRIPTOR))
+        {
+            jassert(parent.hasType(ID::DESCRIPTOR));
+
+            const auto* block = child.getProperty(ID::value).getBinaryData();
+            auto        data  = block != nullptr ? std::vector<gsl::byte>(static_cast<const gsl::byte*>(block->getData()), static_cast<const gsl::byte*>(block->getData()) + block->getSize())
+                                                 : std::vector<gsl::byte>();
+
+            runOnIoThread([this, object_path = parent.getProperty(ID::dbus_object_path).toString(), data = std::move(data)]
+                          { writeDescriptor(to_string_view(object_path), data); });
+        }
+        else if (child.hasType(ID::SCAN))
+        {
+            const auto rng       = ValueTreeRange(child);
+            const auto uuid_strs = rng | ranges::views::transform(property_as<String>(ID::uuid));
+
+            juce::StringArray uuids;
+
+            for (const auto& uuid: uuid_strs)
+                uuids.add(uuid);
+
+            requestScan(child.getProperty(ID::should_start), std::move(uuids), AdvertisementThrottle::getPolicy(child));
+        }
+        else if (child.hasType(ID::BLUETOOTH_DEVICE))
+        {
+            LOG(fmt::format("Bluetooth - Device added: {} ({}), {}",
+                            child.getProperty(ID::name).toString(),
+                            child.getProperty(ID::address).toString(),
+                            child.getProperty(ID::is_connected) ? "connected" : "not connected"));
+        }
+    }
+
+    void valueTreeChildRemoved(ValueTree& parent, ValueTree& child, int) override
+    {
+        // Back to the registry, if compact scanning
+        if (parent == valueTree && child.hasType(ID::BLUETOOTH_DEVICE))
+            registry.demote(DeviceRegistry::toKey(child.getProperty(ID::address).toString()));
+    }
+
+    void discoverServices(const juce::String& address, juce::ValueTree deviceState)
+    {
+        if (connections.find(address) == connections.end())
+            return;
+
+        const juce::String device_path = bluez_utils::get_device_object_path_from_address(bluezAdapter, address);
+
+        std::vector<juce::ValueTree> services;
+
+        for (const auto& path: objectIndex.getChildren(to_string_view(device_path)))
+        {
+            const juce::String object_path(path);
+
+            GDBusInterface* interface = g_dbus_object_manager_get_interface(dbusObjectManager, path.c_str(), "org.bluez.GattService1");
+
+            if (interface != nullptr)
+            {
+                GVariant* uuid_variant = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(interface), "UUID");
+
+                if (uuid_variant != nullptr)
+                {
+                    const juce::Uuid uuid(juce::String(g_variant_get_string(uuid_variant, nullptr)));
+
+                    if (auto* db = findGattDatabase(address))
+                        db->addService(to_string_view(object_path), uuid);
+
+                    services.push_back({ID::SERVICE, {
+                                                             {ID::uuid, uuid.toDashedString()},
+                                                             {ID::dbus_object_path, object_path},
+                                                     },
+                                        {}});
+
+                    g_variant_unref(uuid_variant);
+                }
+
+                g_object_unref(interface);
+            }
+        }
+
+        runOnMessageThread([deviceState, services = std::move(services)]() mutable
+                           {
+                               // Services restored from the GATT cache are already there
+                               for (const auto& service: services)
+                                   if (!deviceState.getChildWithProperty(ID::dbus_object_path, service.getProperty(ID::dbus_object_path)).isValid())
+                                       deviceState.appendChild(service, nullptr);
+
+                               genki::message(deviceState, ID::SERVICES_DISCOVERED);
+                           });
+    }
+
+    // DESCRIPTOR node and cache entry of a GattDescriptor1 object, invalid if the object isn't one. BlueZ keeps the last
+    // value read, which is published straight away.
+    juce::ValueTree discoverDescriptor(const juce::String& address, const juce::Uuid& charactUuid, const std::string& path)
+    {
+        GDBusInterface* interface = g_dbus_object_manager_get_interface(dbusObjectManager, path.c_str(), "org.bluez.GattDescriptor1");
+
+        if (interface == nullptr)
+            return {};
+
+        juce::ValueTree descriptor;
+
+        if (GVariant* uuid_variant = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(interface), "UUID"))
+        {
+            const juce::Uuid uuid(juce::String(g_variant_get_string(uuid_variant, nullptr)));
+
+            descriptor = juce::ValueTree{ID::DESCRIPTOR, {
+                                                                 {ID::uuid, uuid.toDashedString()},
+                                                                 {ID::dbus_object_path, juce::String(path)},
+                                                         },
+                                         {}};
+
+            if (GVariant* value_variant = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(interface), "Value"))
+            {
+                gsize       data_len = 0;
+                const auto* data     = g_variant_get_fixed_array(value_variant, &data_len, sizeof(uint8_t));
+
+                if (data_len > 0)
+                    descriptor.setProperty(ID::value, juce::MemoryBlock(data, data_len), nullptr);
+
+                g_variant_unref(value_variant);
+            }
+
+            descriptorDiscovered(address, path, uuid, charactUuid, descriptor);
+
+            g_variant_unref(uuid_variant);
+        }
+
+        g_object_unref(interface);
+
+        return descriptor;
+    }
+
+    // CHARACTERISTIC node and cache entry of a GattCharacteristic1 object, with its descriptors. Invalid if the object
+    // isn't one.
+    juce::ValueTree discoverCharacteristic(const juce::String& address, const std::string& path)
+    {
+        GDBusInterface* interface = g_dbus_object_manager_get_interface(dbusObjectManager, path.c_str(), "org.bluez.GattCharacteristic1");
+
+        if (interface == nullptr)
+            return {};
+
+        juce::ValueTree charact;
+
+        if (GVariant* uuid_variant = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(interface), "UUID"))
+        {
+            const juce::Uuid   uuid(juce::String(g_variant_get_string(uuid_variant, nullptr)));
+            const juce::String object_path(path);
+            const int          properties = bluez_utils::get_characteristic_properties(G_DBUS_PROXY(interface));
+
+            charact = juce::ValueTree{ID::CHARACTERISTIC, {
+                                                                  {ID::uuid, uuid.toDashedString()},
+                                                                  {ID::dbus_object_path, object_path},
+                                                                  {ID::properties, properties},
+                                                                  {ID::can_write_with_response, (properties & CharacteristicProperty::Write) != 0},
+                                                                  {ID::can_write_without_response, (properties & CharacteristicProperty::WriteWithoutResponse) != 0},
+                                                          },
+                                      {}};
+
+            // Note: Listeners may subscribe as soon as the node is added, the proxy has to be ready by then
+            characteristicDiscovered(address, object_path, uuid, charact);
+
+            for (const auto& descriptor_path: objectIndex.getChildren(path))
+                if (auto descriptor = discoverDescriptor(address, uuid, descriptor_path); descriptor.isValid())
+                    charact.appendChild(descriptor, nullptr);
+
+            if (auto* db = findGattDatabase(address))
+                db->addCharacteristic(path, uuid);
+
+            // Only published by BlueZ 5.62 and later
+            if (GVariant* mtu_variant = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(interface), "MTU"))
+            {
+                mtuChanged(address, g_variant_get_uint16(mtu_variant));
+                g_variant_unref(mtu_variant);
+            }
+
+            g_variant_unref(uuid_variant);
+        }
+
+        g_object_unref(interface);
+
+        return charact;
+    }
+
+    // Services, characteristics and descriptors in one walk over the device's subtree, announced by a single
+    // ALL_DISCOVERED message
+    void discoverAll(const juce::String& address, juce::ValueTree deviceState)
+    {
+        if (connections.find(address) == connections.end())
+            return;
+
+        const juce::String device_path = bluez_utils::get_device_object_path_from_address(bluezAdapter, address);
+
+        juce::ValueTree discovered{ID::BLUETOOTH_DEVICE};
+        collectGattDatabase(address, to_string_view(device_path), discovered);
+
+        runOnMessageThread([owner = weakThis, deviceState, discovered]
+                           {
+                               mergeDiscovered(owner, deviceState, discovered);
+                               genki::message(deviceState, ID::ALL_DISCOVERED);
+                           });
+    }
+
+    // Appends a SERVICE node per service of the device to parent, with its characteristics and descriptors
+    void collectGattDatabase(const juce::String& address, std::string_view device_path, juce::ValueTree& parent)
+    {
+        for (const auto& service_path: objectIndex.getChildren(device_path))
+        {
+            const auto service_uuid = bluez_utils::get_object_uuid(dbusObjectManager, service_path.c_str(), "org.bluez.GattService1");
+
+            if (!service_uuid.has_value())
+                continue;
+
+            if (auto* db = findGattDatabase(address))
+                db->addService(service_path, *service_uuid);
+
+            juce::ValueTree service{ID::SERVICE, {
+                                                         {ID::uuid, service_uuid->toDashedString()},
+                                                         {ID::dbus_object_path, juce::String(service_path)},
+                                                 },
+                                    {}};
+
+            for (const auto& charact_path: objectIndex.getChildren(service_path))
+                if (auto charact = discoverCharacteristic(address, charact_path); charact.isValid())
+                    service.appendChild(charact, nullptr);
+
+            parent.appendChild(service, nullptr);
+        }
+    }
+
+    // Moves the children of source that target doesn't have yet, matched by object path, and merges the others. Nodes
+    // restored from the GATT cache or discovered before stay as they are, they are collected in kept.
+    static void mergeByObjectPath(juce::ValueTree target, juce::ValueTree source, std::vector<std::pair<std::string, juce::ValueTree>>& kept)
+    {
+        while (source.getNumChildren() > 0)
+        {
+            auto child = source.getChild(0);
+            source.removeChild(0, nullptr);
+
+            if (auto existing = target.getChildWithProperty(ID::dbus_object_path, child.getProperty(ID::dbus_object_path)); existing.isValid())
+            {
+                kept.emplace_back(existing.getProperty(ID::dbus_object_path).toString().toStdString(), existing);
+                mergeByObjectPath(existing, child, kept);
+            }
+            else
+            {
+                target.appendChild(child, nullptr);
+            }
         }
     }
 
-    void characteristicValueChanged(std::string_view object_path, gsl::span<const gsl::byte> data)
+    // Called on the message thread with nodes built by discovery. The cache entries of the nodes that were merged into
+    // existing ones still point at the discarded copies, they are pointed at the nodes in the tree instead.
+    static void mergeDiscovered(const juce::WeakReference<Impl>& owner, juce::ValueTree target, juce::ValueTree source)
     {
-        const auto it = std::find_if(characteristicCache.begin(), characteristicCache.end(), [&](const auto& ent)
-                                     { return ent.dbusObjectPath.compare(object_path.data()) == 0; });
+        std::vector<std::pair<std::string, juce::ValueTree>> kept;
+        mergeByObjectPath(target, source, kept);
+
+        if (auto* p = owner.get(); p != nullptr && !kept.empty())
+            p->runOnIoThread([p, kept = std::move(kept)] { p->repointCacheEntries(kept); });
+    }
 
-        if (it != characteristicCache.end())
+    void repointCacheEntries(const std::vector<std::pair<std::string, juce::ValueTree>>& nodes)
+    {
+        for (const auto& [path, node]: nodes)
         {
-            [[maybe_unused]] const auto& [_, uuid, callback, obj_path] = *it;
-            callback->valueChanged(uuid, data);
+            if (const auto it = characteristicCache.find(path); it != characteristicCache.end())
+                it->second.state = node;
+            else if (const auto dit = descriptorCache.find(path); dit != descriptorCache.end())
+                dit->second.state = node;
         }
     }
 
-    void characteristicWritten(const juce::Uuid&, bool)
+    void discoverCharacteristics(const juce::String& address, const juce::String& service_path, juce::ValueTree service)
     {
-        // TODO
+        juce::ValueTree discovered{ID::SERVICE};
+
+        for (const auto& path: objectIndex.getChildren(to_string_view(service_path)))
+            if (auto charact = discoverCharacteristic(address, path); charact.isValid())
+                discovered.appendChild(charact, nullptr);
+
+        runOnMessageThread([owner = weakThis, service, discovered] { mergeDiscovered(owner, service, discovered); });
     }
 
-    //==================================================================================================================
-    void valueTreeChildAdded(ValueTree& parent, ValueTree& child) override
+    void enableNotifications(std::string_view characteristic_object_path, bool acquire)
     {
-        if (child.hasType(ID::DISCOVER_SERVICES))
+        const auto it = characteristicCache.find(characteristic_object_path);
+
+        if (it == characteristicCache.end())
         {
-            auto deviceState = parent;
-            jassert(deviceState.hasType(ID::BLUETOOTH_DEVICE));
+            LOG(fmt::format("Bluetooth - Characteristic not discovered: {}", characteristic_object_path));
+            return;
+        }
 
-            if (auto it = connections.find(deviceState.getProperty(ID::address).toString()); it != connections.end())
+        if (auto* db = findGattDatabase(it->second.address))
+        {
+            if (auto* charact = db->findCharacteristic(characteristic_object_path))
             {
-                const auto& address = it->first;
-
-                const juce::String device_path = bluez_utils::get_device_object_path_from_address(bluezAdapter, address);
+                charact->notify  = true;
+                charact->acquire = acquire;
+            }
+        }
 
-                GList* objects = g_dbus_object_manager_get_objects(dbusObjectManager);
+        auto& charact = it->second;
 
-                for (GList* l = objects; l != NULL; l = l->next)
-                {
-                    GDBusObject*       object = G_DBUS_OBJECT(l->data);
-                    const juce::String object_path(g_dbus_object_get_object_path(object));
-
-                    if (object_path.startsWith(device_path))
-                    {
-                        GDBusInterface* interface = g_dbus_object_get_interface(object, "org.bluez.GattService1");
-
-                        if (interface != nullptr)
-                        {
-                            GVariant* uuid_variant = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(interface), "UUID");
-
-                            if (uuid_variant != nullptr)
-                            {
-                                const juce::Uuid uuid(juce::String(g_variant_get_string(uuid_variant, nullptr)));
-
-                                deviceState.appendChild({ID::SERVICE, {
-                                                                              {ID::uuid, uuid.toDashedString()},
-                                                                              {ID::dbus_object_path, object_path},
-                                                                      },
-                                                         {}},
-                                                        nullptr);
-
-                                g_variant_unref(uuid_variant);
-                            }
-
-                            g_object_unref(interface);
-                        }
-                    }
-                }
+        if (charact.notifyChannel == nullptr)
+            charact.notifyChannel = std::make_unique<NotifyChannel>(charact, it->first);
 
-                g_list_free_full(objects, g_object_unref);
+        // Answered right away if already subscribed, e.g. when restored from the GATT cache
+        charact.notifyChannel->enable(acquire);
+    }
 
-                genki::message(deviceState, ID::SERVICES_DISCOVERED);
-            }
-        }
-        else if (child.hasType(ID::DISCOVER_CHARACTERISTICS))
+    void acquireNotify(const CharacteristicCacheEntry& charact, const NotifyChannel&)
+    {
+        const auto on_notify_acquired = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
         {
-            const auto device = getAncestor(child, ID::BLUETOOTH_DEVICE);
-            jassert(device.isValid());
+            GError*      err      = nullptr;
+            gint         fd_index = -1;
+            guint16      mtu      = 0;
+            GUnixFDList* fd_list  = nullptr;
 
-            auto service = parent;
-            jassert(service.hasType(ID::SERVICE));
+            OrgBluezGattCharacteristic1* charact = ORG_BLUEZ_GATT_CHARACTERISTIC1(source_object);
+            auto*                        p       = reinterpret_cast<BleAdapter::Impl*>(user_data);
 
-            GList*             objects      = g_dbus_object_manager_get_objects(dbusObjectManager);
-            const juce::String service_path = service.getProperty(ID::dbus_object_path);
+            const char* object_path = g_dbus_proxy_get_object_path(G_DBUS_PROXY(charact));
+            int         fd          = -1;
 
-            for (GList* l = objects; l != NULL; l = l->next)
+            if (org_bluez_gatt_characteristic1_call_acquire_notify_finish(charact, &fd_index, &mtu, &fd_list, res, &err))
+            {
+                fd = bluez_utils::get_fd_from_list(fd_list, fd_index);
+                g_object_unref(fd_list);
+            }
+            else
             {
-                GDBusObject*       object = G_DBUS_OBJECT(l->data);
-                const juce::String object_path(g_dbus_object_get_object_path(object));
+                LOG(fmt::format("Bluetooth - Error acquiring notifications for characteristic, falling back to StartNotify: {} - {}\n", object_path, err->message));
+                g_error_free(err);
+            }
 
-                if (object_path.startsWith(service_path))
-                {
-                    GDBusInterface* interface = g_dbus_object_get_interface(object, "org.bluez.GattCharacteristic1");
+            // Gone in the meantime, e.g. disconnected
+            auto* channel = p->findNotifyChannel(object_path);
+
+            if (channel == nullptr)
+            {
+                if (fd >= 0)
+                    close(fd);
+            }
+            else if (fd >= 0)
+            {
+                channel->acquired(fd, mtu);
+            }
+            else
+            {
+                channel->acquireFailed();
+            }
+        };
 
-                    if (interface != nullptr)
-                    {
-                        GVariant* uuid_variant = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(interface), "UUID");
+        org_bluez_gatt_characteristic1_call_acquire_notify(
+                charact.characteristicProxy.get(),
+                g_variant_new("a{sv}", nullptr),
+                nullptr, // fd_list
+                nullptr, // cancelable
+                on_notify_acquired,
+                this);
+    }
 
-                        if (uuid_variant != nullptr)
-                        {
-                            const juce::Uuid uuid(juce::String(g_variant_get_string(uuid_variant, nullptr)));
+    void startNotify(const CharacteristicCacheEntry& charact, const NotifyChannel&)
+    {
+        const auto on_notify_ready = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
+        {
+            GError* err = nullptr;
 
-                            service.appendChild({ID::CHARACTERISTIC, {
-                                                                             {ID::uuid, uuid.toDashedString()},
-                                                                             {ID::dbus_object_path, object_path},
-                                                                     },
-                                                 {}},
-                                                nullptr);
+            OrgBluezGattCharacteristic1* charact = ORG_BLUEZ_GATT_CHARACTERISTIC1(source_object);
+            auto*                        p       = reinterpret_cast<BleAdapter::Impl*>(user_data);
 
-                            g_variant_unref(uuid_variant);
-                        }
+            const char* object_path = g_dbus_proxy_get_object_path(G_DBUS_PROXY(charact));
+            const bool  success     = org_bluez_gatt_characteristic1_call_start_notify_finish(charact, res, &err);
 
-                        g_object_unref(interface);
-                    }
-                }
+            if (!success)
+            {
+                LOG(fmt::format("Bluetooth - Error enabling notifications for characteristic: {} - {}\n", object_path, err->message));
+                g_error_free(err);
             }
 
-            g_list_free_full(objects, g_object_unref);
-        }
-        else if (child.hasType(ID::ENABLE_NOTIFICATIONS) || child.hasType(ID::ENABLE_INDICATIONS))
-        {
-            jassert(parent.hasType(ID::CHARACTERISTIC));
-            auto characteristic = parent;
+            auto* channel = p->findNotifyChannel(object_path);
 
-            const auto device = getAncestor(characteristic, ID::BLUETOOTH_DEVICE);
-            jassert(device.isValid());
+            if (channel == nullptr)
+                return;
 
-            const juce::String characteristic_object_path = characteristic.getProperty(ID::dbus_object_path);
-            GDBusObject*       obj                        = g_dbus_object_manager_get_object(dbusObjectManager, characteristic_object_path.getCharPointer());
+            if (success)
+                channel->started();
+            else
+                channel->startFailed();
+        };
 
-            if (obj != nullptr)
-            {
-                GDBusInterface* interface = g_dbus_object_get_interface(obj, "org.bluez.GattCharacteristic1");
+        org_bluez_gatt_characteristic1_call_start_notify(
+                charact.characteristicProxy.get(),
+                nullptr, // cancelable
+                on_notify_ready,
+                this);
+    }
 
-                if (interface != nullptr)
-                {
-                    GError* error = nullptr;
+    void scan(bool shouldStart, const juce::StringArray& uuids)
+    {
+        if (!shouldStart)
+            LOG("Bluetooth - Stopping scan...");
+        else if (uuids.isEmpty())
+            LOG("Bluetooth - Starting scan...");
+        else
+            LOG(fmt::format("Bluetooth - Starting scan for services:\n{}", uuids.joinIntoString("\n")));
 
-                    OrgBluezGattCharacteristic1* char_proxy = org_bluez_gatt_characteristic1_proxy_new_sync(
-                            g_dbus_proxy_get_connection(G_DBUS_PROXY(interface)),
-                            G_DBUS_PROXY_FLAGS_NONE,
-                            "org.bluez",
-                            g_dbus_proxy_get_object_path(G_DBUS_PROXY(interface)),
-                            nullptr,
-                            &error);
+        scanControl.wantsScan = shouldStart;
 
-                    const auto on_notify_ready = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
-                    {
-                        GError* err = nullptr;
+        if (shouldStart)
+            scanControl.wantedUuids = uuids;
 
-                        OrgBluezGattCharacteristic1* charact = ORG_BLUEZ_GATT_CHARACTERISTIC1(source_object);
-                        auto*                        p       = reinterpret_cast<BleAdapter::Impl*>(user_data);
+        updateScan();
+    }
 
-                        const auto uuid = juce::Uuid(juce::String(org_bluez_gatt_characteristic1_get_uuid(charact)));
+    // Issues the next call towards the requested state, if none is in flight
+    void updateScan()
+    {
+        using Call = ScanControl::Call;
 
-                        if (!org_bluez_gatt_characteristic1_call_start_notify_finish(charact, res, &err))
-                        {
-                            LOG(fmt::format("Bluetooth - Error enabling notifications for characteristic: {} - {}\n", uuid.toDashedString(), err->message));
+        auto& sc = scanControl;
 
-                            g_error_free(err);
-                            return;
-                        }
+        if (sc.inFlight != Call::None || bluezAdapter == nullptr)
+            return;
 
-                        const char* object_path = g_dbus_proxy_get_object_path(G_DBUS_PROXY(charact));
+        // Known devices are scanned for without a filter, they may not advertise the services asked for
+        const bool should_scan  = sc.wantsScan || !awaitedDevices.empty();
+        const auto wanted_uuids = awaitedDevices.empty() ? sc.wantedUuids : juce::StringArray();
 
-                        if (const auto& ch = findChildWithProperty(p->valueTree, ID::dbus_object_path, object_path); ch.isValid())
-                        {
-                            const auto& dev = getAncestor(ch, ID::BLUETOOTH_DEVICE);
+        const auto on_call_complete = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
+        {
+            auto* p  = reinterpret_cast<BleAdapter::Impl*>(user_data);
+            auto& sc = p->scanControl;
 
-                            if (const auto it = p->connections.find(dev.getProperty(ID::address)); it != p->connections.end())
-                            {
-                                const auto& callbacks = it->second.second;
+            GError*           err     = nullptr;
+            OrgBluezAdapter1* adapter = ORG_BLUEZ_ADAPTER1(source_object);
 
-                                p->characteristicCache.emplace(charact, uuid, callbacks);
-                            }
+            const auto call = std::exchange(sc.inFlight, Call::None);
 
-                            genki::message(ch, {ID::NOTIFICATIONS_ARE_ENABLED, {}});
-                        }
-                    };
+            const bool success = call == Call::SetFilter ? org_bluez_adapter1_call_set_discovery_filter_finish(adapter, res, &err)
+                                 : call == Call::Start   ? org_bluez_adapter1_call_start_discovery_finish(adapter, res, &err)
+                                                         : org_bluez_adapter1_call_stop_discovery_finish(adapter, res, &err);
 
-                    org_bluez_gatt_characteristic1_call_start_notify(
-                            char_proxy,
-                            nullptr, // cancelable
-                            on_notify_ready,
-                            this);
-                }
+            if (!success)
+            {
+                LOG(fmt::format("Bluetooth - Failed to {} discovery: {}", call == Call::SetFilter ? "filter" : call == Call::Start ? "start" : "stop", err->message));
+                g_error_free(err);
             }
-        }
-        else if (child.hasType(ID::SCAN))
-        {
-            if (child.getProperty(ID::should_start))
+
+            // Note: On failure the request is dropped rather than retried, the next scan() tries again
+            switch (call)
             {
-                const auto rng       = ValueTreeRange(child);
-                const auto uuid_strs = rng | ranges::views::transform(property_as<String>(ID::uuid));
+                case Call::SetFilter:
+                    sc.filterUuids = sc.pendingFilterUuids;
+                    break;
 
-                if (ranges::distance(uuid_strs) > 0)
-                {
-                    LOG(fmt::format("Bluetooth - Starting scan for services:\n{}",
-                                    uuid_strs | ranges::views::transform(to_string_view) | ranges::views::join('\n') | ranges::to<std::string>()));
+                case Call::Start:
+                    sc.isScanning = success;
+                    sc.wantsScan  = sc.wantsScan && success;
 
-                    GVariantBuilder props_builder{};
-                    g_variant_builder_init(&props_builder, G_VARIANT_TYPE("a{sv}"));
+                    if (!success)
+                        p->awaitedDevicesNotFound();
+                    break;
 
-                    GVariantBuilder uuid_builder{};
-                    g_variant_builder_init(&uuid_builder, G_VARIANT_TYPE("as"));
+                case Call::Stop:
+                    // Either way the session is gone, BlueZ only fails to stop one that doesn't exist
+                    sc.isScanning = false;
+                    break;
 
-                    for (const auto& uuid: uuid_strs)
-                        g_variant_builder_add(&uuid_builder, "s", uuid.getCharPointer());
+                case Call::None:
+                    break;
+            }
 
-                    g_variant_builder_add(&props_builder, "{sv}", "UUIDs", g_variant_builder_end(&uuid_builder));
-                    g_variant_builder_add(&props_builder, "{sv}", "Transport", g_variant_new_string("le")); // Only LE devices
+            p->updateScan();
+        };
 
-                    GVariant* properties = g_variant_builder_end(&props_builder);
+        if (should_scan && sc.filterUuids != wanted_uuids)
+        {
+            GVariantBuilder props_builder{};
+            g_variant_builder_init(&props_builder, G_VARIANT_TYPE("a{sv}"));
 
-                    GError* error = nullptr;
-                    if (!org_bluez_adapter1_call_set_discovery_filter_sync(
-                                bluezAdapter,
-                                properties,
-                                nullptr, // cancellable
-                                &error))
-                    {
-                        LOG(fmt::format("Bluetooth - Failed to set discovery filter: {}", error->message));
-                    }
-                }
-                else
-                {
-                    LOG("Bluetooth - Starting scan...");
-                }
+            // An empty filter clears the previous one
+            if (!wanted_uuids.isEmpty())
+            {
+                GVariantBuilder uuid_builder{};
+                g_variant_builder_init(&uuid_builder, G_VARIANT_TYPE("as"));
 
-                // TODO: Filter by UUID
-                connectedDevicePoll = std::make_unique<LambdaTimer>([this]
-                                                                    { probeConnectedDevices(); }, 500);
+                for (const auto& uuid: wanted_uuids)
+                    g_variant_builder_add(&uuid_builder, "s", uuid.toRawUTF8());
 
-                GError* error = nullptr;
-                if (!org_bluez_adapter1_call_start_discovery_sync(bluezAdapter, nullptr, &error))
-                {
-                    LOG(fmt::format("Bluetooth - Failed to start discovery: {}", error->message));
-                    g_error_free(error);
-                }
+                g_variant_builder_add(&props_builder, "{sv}", "UUIDs", g_variant_builder_end(&uuid_builder));
+                g_variant_builder_add(&props_builder, "{sv}", "Transport", g_variant_new_string("le")); // Only LE devices
             }
-            else
-            {
-                LOG("Bluetooth - Stopping scan...");
 
-                GError* error = nullptr;
-                if (!org_bluez_adapter1_call_stop_discovery_sync(bluezAdapter, nullptr, &error))
-                {
-                    LOG(fmt::format("Bluetooth - Failed to stop scan: {}", error->message));
-                    g_error_free(error);
-                }
-            }
+            sc.inFlight           = Call::SetFilter;
+            sc.pendingFilterUuids = wanted_uuids;
+
+            org_bluez_adapter1_call_set_discovery_filter(bluezAdapter, g_variant_builder_end(&props_builder), nullptr, on_call_complete, this);
         }
-        else if (child.hasType(ID::BLUETOOTH_DEVICE))
+        else if (should_scan && !sc.isScanning)
         {
-            LOG(fmt::format("Bluetooth - Device added: {} ({}), {}",
-                            child.getProperty(ID::name).toString(),
-                            child.getProperty(ID::address).toString(),
-                            child.getProperty(ID::is_connected) ? "connected" : "not connected"));
+            sc.inFlight = Call::Start;
+            org_bluez_adapter1_call_start_discovery(bluezAdapter, nullptr, on_call_complete, this);
         }
+        else if (!should_scan && sc.isScanning)
+        {
+            sc.inFlight = Call::Stop;
+            org_bluez_adapter1_call_stop_discovery(bluezAdapter, nullptr, on_call_complete, this);
+        }
+    }
+
+    // Discovering covers the sessions of every BlueZ client, not only ours
+    void discoveringChanged(bool isDiscovering)
+    {
+        // Our session can't outlive adapter-wide discovery, e.g. when the adapter was reset. Started again if wanted.
+        if (!isDiscovering && scanControl.isScanning && scanControl.inFlight == ScanControl::Call::None)
+        {
+            scanControl.isScanning = false;
+            updateScan();
+        }
+
+        runOnMessageThread([pvt = valueTree, isDiscovering]() mutable
+                           { pvt.setProperty(ID::is_discovering, isDiscovering, nullptr); });
     }
 
     void dbusObjectAdded(GDBusObject* object)
     {
-        const char*           object_path = g_dbus_object_get_object_path(object);
-        const GDBusInterface* interface   = g_dbus_object_manager_get_interface(dbusObjectManager, object_path, "org.bluez.Device1");
+        const char*     object_path = g_dbus_object_get_object_path(object);
+        GDBusInterface* interface   = g_dbus_object_manager_get_interface(dbusObjectManager, object_path, "org.bluez.Device1");
+
+        objectIndex.add(object_path);
 
         if (interface != nullptr)
         {
-            const DeviceProxy device = bluez_utils::get_device_from_object_path(object_path);
+            OrgBluezDevice1* device = ORG_BLUEZ_DEVICE1(interface);
 
-            const char* addr         = org_bluez_device1_get_address(device.get());
-            const char* name         = org_bluez_device1_get_name(device.get());
-            const auto  rssi         = static_cast<int16_t>(org_bluez_device1_get_rssi(device.get()));
-            const bool  is_connected = org_bluez_device1_get_connected(device.get());
+            const char* addr         = org_bluez_device1_get_address(device);
+            const char* name         = org_bluez_device1_get_name(device);
+            const auto  rssi         = static_cast<int16_t>(org_bluez_device1_get_rssi(device));
+            const bool  is_connected = org_bluez_device1_get_connected(device);
 
             deviceDiscovered(addr ? addr : "", name ? name : "", rssi, is_connected);
+
+            if (addr != nullptr)
+            {
+                advertisementChanged(addr, G_DBUS_PROXY(interface));
+                deviceObjectAdded(bluez_utils::get_address_string(addr), device);
+            }
+
+            g_object_unref(interface);
         }
     }
 
-    void dbusInterfaceProxyPropertiesChanged(GDBusProxy* interface_proxy, GVariant* changed_properties, const gchar* const*)
+    // Fills in the proxy of a known device that was connected to before BlueZ had an object for it. Devices that are
+    // being scanned for are connected now.
+    void deviceObjectAdded(const juce::String& address, OrgBluezDevice1* device)
     {
-        const char*        proxy_object_path = g_dbus_proxy_get_object_path(interface_proxy);
-        const juce::String interface_name(g_dbus_proxy_get_interface_name(interface_proxy));
+        const auto conn = connections.find(address);
 
-        if (interface_name == "org.bluez.Device1")
-        {
-            if (g_variant_n_children(changed_properties) > 0)
-            {
-                DeviceProxy device = bluez_utils::get_device_from_object_path(proxy_object_path);
+        if (conn == connections.end() || conn->second.first != nullptr)
+            return;
 
-                GVariantIter* iter = nullptr;
-                g_variant_get(changed_properties, "a{sv}", &iter);
+        conn->second.first = DeviceProxy(ORG_BLUEZ_DEVICE1(g_object_ref(device)), g_object_unref);
 
-                const gchar* key   = nullptr;
-                GVariant*    value = nullptr;
+        if (stopAwaitingDevice(address))
+            connectDevice(device);
+    }
 
-                while (g_variant_iter_loop(iter, "{&sv}", &key, &value))
-                {
-                    if (strcmp(key, "Connected") == 0)
-                    {
-                        const bool is_connected = g_variant_get_boolean(value);
-                        LOG(fmt::format("Bluetooth - Device state changed: {}", is_connected ? "Connected" : "Disconnected"));
-
-                        if (!is_connected)
-                            deviceDisconnected(device.get());
-                    }
-                    else if (strcmp(key, "ServicesResolved") == 0)
-                    {
-                        if (g_variant_get_boolean(value))
-                            deviceConnected(device.get(), true);
-                    }
-                    else if (strcmp(key, "RSSI") == 0)
-                    {
-                        const auto rssi = static_cast<int16_t>(g_variant_get_int16(value));
-
-                        const char* addr         = org_bluez_device1_get_address(device.get());
-                        const char* name         = org_bluez_device1_get_name(device.get());
-                        const bool  is_connected = org_bluez_device1_get_connected(device.get());
-
-                        deviceDiscovered(addr ? addr : "", name ? name : "", rssi, is_connected);
-                    }
-                }
+    void dbusObjectRemoved(GDBusObject* object)
+    {
+        objectIndex.remove(g_dbus_object_get_object_path(object));
 
-                g_variant_iter_free(iter);
-            }
-        }
-        else if (interface_name == "org.bluez.GattCharacteristic1")
+        GDBusInterface* interface = g_dbus_object_get_interface(object, "org.bluez.Device1");
+
+        if (interface == nullptr)
+            return;
+
+        // BlueZ removes the object when the device is unpaired or drops out of its cache
+        if (GVariant* address_variant = g_dbus_proxy_get_cached_property(G_DBUS_PROXY(interface), "Address"))
         {
-            if (g_variant_n_children(changed_properties) > 0)
-            {
-                GVariantIter* iter = nullptr;
-                g_variant_get(changed_properties, "a{sv}", &iter);
+            deviceDisconnected(juce::String(g_variant_get_string(address_variant, nullptr)));
+            g_variant_unref(address_variant);
+        }
 
-                const gchar* key   = nullptr;
-                GVariant*    value = nullptr;
+        g_object_unref(interface);
+    }
 
-                while (g_variant_iter_loop(iter, "{&sv}", &key, &value))
-                {
-                    if (strcmp(key, "Value") == 0)
-                    {
-                        const uint8_t* data     = nullptr;
-                        gsize          data_len = 0;
-                        data                    = static_cast<const uint8_t*>(g_variant_get_fixed_array(value, &data_len, sizeof(uint8_t)));
-
-                        characteristicValueChanged(
-                                std::string_view(proxy_object_path),
-                                gsl::as_bytes(gsl::span(data, static_cast<size_t>(data_len))));
-                    }
-                }
+    void dbusInterfaceProxyPropertiesChanged(GDBusProxy* interface_proxy, GVariant* changed_properties, const gchar* const*)
+    {
+        using Interface = PropertyDispatchTable::Interface;
+        using Property  = PropertyDispatchTable::Property;
 
-                g_variant_iter_free(iter);
-            }
+        const auto interface = propertyDispatch.getInterface(g_dbus_proxy_get_interface_name(interface_proxy));
+
+        if (interface == Interface::Unknown || g_variant_n_children(changed_properties) == 0)
+            return;
+
+        const char* proxy_object_path = g_dbus_proxy_get_object_path(interface_proxy);
+
+        if (interface == Interface::Adapter)
+        {
+            propertyDispatch.forEachChanged(interface, changed_properties, [&](Property property, GVariant* value)
+                                            {
+                                                if (property == Property::Discovering && strcmp(proxy_object_path, g_dbus_proxy_get_object_path(G_DBUS_PROXY(bluezAdapter))) == 0)
+                                                    discoveringChanged(g_variant_get_boolean(value));
+                                            });
+        }
+        else if (interface == Interface::Device)
+        {
+            // Note: The object manager's proxy is typed, its cached properties are already up to date
+            OrgBluezDevice1* device = ORG_BLUEZ_DEVICE1(interface_proxy);
+
+            bool advertisement_changed = false;
+
+            propertyDispatch.forEachChanged(interface, changed_properties, [&](Property property, GVariant* value)
+                                            {
+                                                switch (property)
+                                                {
+                                                    case Property::Connected:
+                                                    {
+                                                        const bool is_connected = g_variant_get_boolean(value);
+                                                        LOG(fmt::format("Bluetooth - Device state changed: {}", is_connected ? "Connected" : "Disconnected"));
+
+                                                        if (is_connected)
+                                                        {
+                                                            const char* addr = org_bluez_device1_get_address(device);
+                                                            const char* name = org_bluez_device1_get_name(device);
+                                                            const auto  rssi = static_cast<int16_t>(org_bluez_device1_get_rssi(device));
+
+                                                            deviceDiscovered(addr ? addr : "", name ? name : "", rssi, true);
+
+                                                            // Published while BlueZ resolves the services
+                                                            if (addr != nullptr)
+                                                                restoreGattDatabase(bluez_utils::get_address_string(addr));
+                                                        }
+                                                        else
+                                                        {
+                                                            deviceDisconnected(bluez_utils::get_device_address(device));
+                                                        }
+                                                        break;
+                                                    }
+                                                    case Property::ServicesResolved:
+                                                        if (g_variant_get_boolean(value))
+                                                            deviceConnected(device, true);
+                                                        break;
+
+                                                    case Property::Rssi:
+                                                    {
+                                                        const auto rssi = static_cast<int16_t>(g_variant_get_int16(value));
+
+                                                        const char* addr         = org_bluez_device1_get_address(device);
+                                                        const char* name         = org_bluez_device1_get_name(device);
+                                                        const bool  is_connected = org_bluez_device1_get_connected(device);
+
+                                                        deviceDiscovered(addr ? addr : "", name ? name : "", rssi, is_connected);
+                                                        break;
+                                                    }
+                                                    case Property::Advertisement:
+                                                        advertisement_changed = true;
+                                                        break;
+
+                                                    default:
+                                                        break;
+                                                }
+                                            });
+
+            // Rebuilt once, however many of the fields changed in the same signal
+            if (const char* addr = org_bluez_device1_get_address(device); advertisement_changed && addr != nullptr)
+                advertisementChanged(addr, interface_proxy);
+        }
+        else if (interface == Interface::Characteristic)
+        {
+            propertyDispatch.forEachChanged(interface, changed_properties, [&](Property property, GVariant* value)
+                                            {
+                                                switch (property)
+                                                {
+                                                    case Property::WriteAcquired:
+                                                        // BlueZ drops the socket when the link is re-established or the MTU changes
+                                                        if (!g_variant_get_boolean(value))
+                                                            if (const auto it = characteristicCache.find(std::string_view(proxy_object_path)); it != characteristicCache.end())
+                                                                if (const auto& channel = it->second.writeChannel; channel != nullptr && channel->fd >= 0)
+                                                                    writeChannelLost(channel->dbusObjectPath);
+                                                        break;
+
+                                                    case Property::Mtu:
+                                                        if (const auto it = characteristicCache.find(std::string_view(proxy_object_path)); it != characteristicCache.end())
+                                                            mtuChanged(it->second.address, g_variant_get_uint16(value));
+                                                        break;
+
+                                                    case Property::Value:
+                                                    {
+                                                        gsize       data_len = 0;
+                                                        const auto* data     = static_cast<const uint8_t*>(g_variant_get_fixed_array(value, &data_len, sizeof(uint8_t)));
+
+                                                        characteristicValueChanged(
+                                                                std::string_view(proxy_object_path),
+                                                                gsl::as_bytes(gsl::span(data, static_cast<size_t>(data_len))));
+                                                        break;
+                                                    }
+                                                    default:
+                                                        break;
+                                                }
+                                            });
         }
     }
 
@@ -645,7 +2403,7 @@ struct BleAdapter::Impl : private juce::ValueTree::Listener
                 G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_NONE,
                 "org.bluez",
                 "/",
-                nullptr, // get_proxy_type_func
+                bluez_utils::get_proxy_type,
                 nullptr, // get_proxy_type_user_data
                 nullptr, // get_proxy_type_destroy_notify
                 nullptr, // cancellable
@@ -670,6 +2428,16 @@ struct BleAdapter::Impl : private juce::ValueTree::Listener
 
             g_signal_connect(G_DBUS_OBJECT_MANAGER(dbusObjectManager), "object-added", G_CALLBACK(on_object_added), this);
 
+            const ObjectAddedFn on_object_removed = []([[maybe_unused]] auto* manager, auto* object, auto user_data)
+            {
+                auto* p = reinterpret_cast<BleAdapter::Impl*>(user_data);
+                jassert(manager == p->dbusObjectManager);
+
+                p->dbusObjectRemoved(object);
+            };
+
+            g_signal_connect(G_DBUS_OBJECT_MANAGER(dbusObjectManager), "object-removed", G_CALLBACK(on_object_removed), this);
+
             using PropertiesChangedFn                                       = void (*)(GDBusObjectManager*, GDBusObjectProxy*, GDBusProxy*, GVariant*, const gchar* const*, gpointer);
             const PropertiesChangedFn on_interface_proxy_properties_changed = []([[maybe_unused]] auto* manager, auto*, auto* interface_proxy, auto* changed_properties, auto invalidated_properties, auto user_data)
             {
@@ -680,106 +2448,184 @@ struct BleAdapter::Impl : private juce::ValueTree::Listener
             };
 
             g_signal_connect(G_DBUS_OBJECT_MANAGER(dbusObjectManager), "interface-proxy-properties-changed", G_CALLBACK(on_interface_proxy_properties_changed), this);
+
+            // From here on, connection changes and new objects arrive as signals
+            importManagedObjects();
         }
     }
 
-    void probeConnectedDevices()
+    // Warm start. The object manager fetched every object with a single GetManagedObjects call when it was created, all
+    // devices BlueZ knows are published from that snapshot in one batch. Connected ones come with their GATT database.
+    void importManagedObjects()
     {
-        GList* objects = nullptr;
-
-        objects = g_dbus_object_manager_get_objects(dbusObjectManager);
+        GList* objects = g_dbus_object_manager_get_objects(dbusObjectManager);
 
+        // Note: Indexed first, services are found through the index
         for (GList* l = objects; l != nullptr; l = l->next)
-        {
-            GDBusObject* object = G_DBUS_OBJECT(l->data);
-
-            const char* object_path = g_dbus_object_get_object_path(object);
-
-            if (!strstr(object_path, "/dev_"))
-                continue;
+            objectIndex.add(g_dbus_object_get_object_path(G_DBUS_OBJECT(l->data)));
 
+        const auto                   now = (int) juce::Time::getMillisecondCounter();
+        std::vector<juce::ValueTree> devices;
 
+        for (GList* l = objects; l != nullptr; l = l->next)
+        {
+            GDBusObject*    object    = G_DBUS_OBJECT(l->data);
             GDBusInterface* interface = g_dbus_object_get_interface(object, "org.bluez.Device1");
+
             if (interface == nullptr)
                 continue;
 
-            GDBusProxy* proxy = G_DBUS_PROXY(interface);
+            OrgBluezDevice1* device = ORG_BLUEZ_DEVICE1(interface);
 
-            GVariant* connected_variant = g_dbus_proxy_get_cached_property(proxy, "Connected");
-            if (connected_variant != nullptr)
+            const char* addr         = org_bluez_device1_get_address(device);
+            const char* name         = org_bluez_device1_get_name(device);
+            const auto  rssi         = static_cast<int16_t>(org_bluez_device1_get_rssi(device));
+            const bool  is_connected = org_bluez_device1_get_connected(device);
+
+            // Devices that are neither connected nor promoted stay in the registry, without a node
+            if (addr != nullptr && (!compactScanning || registry.update(DeviceRegistry::toKey(addr), name, rssi, now, is_connected)))
             {
-                const bool is_connected = g_variant_get_boolean(connected_variant);
-                g_variant_unref(connected_variant);
+                const auto addr_str = bluez_utils::get_address_string(addr);
 
-                if (is_connected)
-                {
-                    GVariant* name_variant    = g_dbus_proxy_get_cached_property(proxy, "Name");
-                    GVariant* address_variant = g_dbus_proxy_get_cached_property(proxy, "Address");
-                    GVariant* rssi_variant    = g_dbus_proxy_get_cached_property(proxy, "RSSI");
+                encodeAdvertisement(G_DBUS_PROXY(interface));
 
-                    if (address_variant)
-                    {
-                        const char*   addr = g_variant_get_string(address_variant, nullptr);
-                        const char*   name = name_variant ? g_variant_get_string(name_variant, nullptr) : "";
-                        const int16_t rssi = rssi_variant ? g_variant_get_int16(rssi_variant) : 0;
+                if (advertisementCallback)
+                    advertisementCallback(addr_str, AdvertisementData(advertisementRecord));
 
-                        deviceDiscovered(addr ? addr : "", name ? name : "", rssi, is_connected);
+                juce::ValueTree vt{ID::BLUETOOTH_DEVICE, {
+                                                                 {ID::name, juce::String(name)},
+                                                                 {ID::address, addr_str},
+                                                                 {ID::rssi, rssi},
+                                                                 {ID::is_connected, is_connected},
+                                                                 {ID::last_seen, now},
+                                                                 {ID::advertisement, juce::MemoryBlock(advertisementRecord.data(), advertisementRecord.size())},
+                                                         },
+                                   {}};
 
-                        if (name_variant)
-                            g_variant_unref(name_variant);
+                if (is_connected && org_bluez_device1_get_services_resolved(device))
+                    collectGattDatabase(addr_str, g_dbus_object_get_object_path(object), vt);
 
-                        g_variant_unref(address_variant);
-                    }
-                }
+                devices.push_back(vt);
             }
 
             g_object_unref(interface);
         }
 
         g_list_free_full(objects, g_object_unref);
+
+        LOG(fmt::format("Bluetooth - Imported {} devices from BlueZ", devices.size()));
+
+        runOnMessageThread([owner = weakThis, vt = valueTree, index = deviceIndex, devices = std::move(devices)]() mutable
+                           {
+                               for (const auto& device: devices)
+                               {
+                                   // Promoted from the known devices before the adapter was ready
+                                   if (auto existing = index->find(device.getProperty(ID::address).toString()); existing.isValid())
+                                   {
+                                       for (int i = 0; i < device.getNumProperties(); ++i)
+                                           existing.setProperty(device.getPropertyName(i), device.getProperty(device.getPropertyName(i)), nullptr);
+
+                                       mergeDiscovered(owner, existing, device);
+                                   }
+                                   else
+                                   {
+                                       vt.appendChild(device, nullptr);
+                                   }
+                               }
+                           });
     }
 
     //==================================================================================================================
     juce::ValueTree valueTree;
 
+    // Shared with the updates posted to the message thread, which may outlive the adapter. The index is the adapter's.
+    std::shared_ptr<DeviceIndex>           deviceIndex;
+    std::shared_ptr<AdvertisementThrottle> advertisements = std::make_shared<AdvertisementThrottle>(valueTree);
+
+    // Captured by updates posted from the I/O thread, created on the message thread since WeakReference isn't
+    // thread-safe to create
+    juce::WeakReference<Impl> weakThis;
+
     std::map<juce::String, std::pair<DeviceProxy, BleDevice::Callbacks>> connections;
 
-    struct CharacteristicCacheEntry
-    {
-        CharacteristicCacheEntry(OrgBluezGattCharacteristic1* charact, juce::Uuid u, const genki::BleDevice::Callbacks& cbs)
-            : characteristicProxy(charact, g_object_unref),
-              uuid(std::move(u)),
-              callbacks(&cbs),
-              dbusObjectPath(g_dbus_proxy_get_object_path(G_DBUS_PROXY(characteristicProxy.get())))
-        {
-        }
+    //==================================================================================================================
+    ObjectPathMap<CharacteristicCacheEntry> characteristicCache;
+    ObjectPathMap<DescriptorCacheEntry>     descriptorCache;
 
-        CharacteristicProxy                characteristicProxy;
-        const juce::Uuid                   uuid;
-        const genki::BleDevice::Callbacks* callbacks;
-        const juce::String                 dbusObjectPath;
+    // Object paths of every cached characteristic and descriptor, per device address
+    std::unordered_map<juce::String, std::vector<std::string>> characteristicsByDevice;
 
-        bool operator<(const CharacteristicCacheEntry& rhs) const
-        {
-            return dbusObjectPath.compare(rhs.dbusObjectPath) < 0;
-        }
-    };
+    // Negotiated ATT MTU per device address, once BlueZ has reported it
+    std::unordered_map<juce::String, uint16_t> negotiatedMtu;
+
+    //==================================================================================================================
+    std::unordered_map<juce::String, WritePipeline> writePipelines;
+
+    juce::CriticalSection writePipelinesLock;
 
-    std::set<CharacteristicCacheEntry> characteristicCache;
+    uint32_t            lastWritePipelineId = 0;
+    std::atomic<size_t> maxWritesInFlightWithResponse{1};
+    std::atomic<size_t> maxWritesInFlightWithoutResponse{4};
+
+    DeviceRegistry&   registry;
+    std::atomic<bool> compactScanning{false};
+
+    KnownDevices& knownDevices;
+
+    ScanControl scanControl;
+
+    // Known devices that couldn't be connected to directly, connected once the scan finds them. Each has a source that
+    // gives up on it after KnownDeviceScanTimeoutMs.
+    std::unordered_map<juce::String, GSource*> awaitedDevices;
+
+    GattCache                                        gattCache;
+    std::unordered_map<juce::String, CachedDatabase> gattDatabases;
 
     OrgBluezAdapter1*   bluezAdapter      = nullptr;
     GDBusObjectManager* dbusObjectManager = nullptr;
+    ObjectPathIndex     objectIndex;
+
+    const PropertyDispatchTable propertyDispatch;
+
+    BleAdapter::AdvertisementCallback advertisementCallback;
+    std::vector<gsl::byte>            advertisementRecord;
+
+    std::unique_ptr<IoThread> ioThread;
 
-    std::unique_ptr<LambdaTimer> connectedDevicePoll;
+    JUCE_DECLARE_WEAK_REFERENCEABLE(Impl)
 };
 
 //======================================================================================================================
-BleAdapter::Impl::Impl(ValueTree vt) : valueTree(std::move(vt))
+BleAdapter::Impl::Impl(ValueTree vt, std::shared_ptr<DeviceIndex> index, DeviceRegistry& r, KnownDevices& k)
+    : valueTree(std::move(vt)),
+      deviceIndex(std::move(index)),
+      registry(r),
+      knownDevices(k)
+{
+    weakThis = this;
+
+#if GENKI_BLUETOOTH_IO_THREAD
+    ioThread = std::make_unique<IoThread>();
+#endif
+
+    runOnIoThread([this] { openAdapter(); });
+
+    valueTree.addListener(this);
+}
+
+BleAdapter::Impl::~Impl()
+{
+    if (ioThread != nullptr)
+        ioThread->stop([this] { releaseResources(); });
+    else
+        releaseResources();
+}
+
+void BleAdapter::Impl::openAdapter()
 {
     const auto on_adapter_ready = [](GObject* source_object, GAsyncResult* res, gpointer user_data)
     {
-        auto* p   = reinterpret_cast<BleAdapter::Impl*>(user_data);
-        auto& pvt = p->valueTree;
+        auto* p = reinterpret_cast<BleAdapter::Impl*>(user_data);
 
         GError* error   = nullptr;
         p->bluezAdapter = ORG_BLUEZ_ADAPTER1(source_object);
@@ -787,7 +2633,9 @@ BleAdapter::Impl::Impl(ValueTree vt) : valueTree(std::move(vt))
         if (!org_bluez_adapter1_proxy_new_for_bus_finish(res, &error))
         {
             LOG(fmt::format("Bluetooth - Error opening default adapter: {}\n", error->message));
-            pvt.setProperty(ID::status, static_cast<int>(AdapterStatus::Disabled), nullptr);
+
+            p->runOnMessageThread([pvt = p->valueTree]() mutable
+                                  { pvt.setProperty(ID::status, static_cast<int>(AdapterStatus::Disabled), nullptr); });
 
             g_error_free(error);
         }
@@ -798,10 +2646,17 @@ BleAdapter::Impl::Impl(ValueTree vt) : valueTree(std::move(vt))
             const juce::String name(org_bluez_adapter1_get_name(p->bluezAdapter));
             LOG(fmt::format("Bluetooth - Opened adapter: {}", name));
 
-            pvt.setProperty(ID::name, name, nullptr);
-            pvt.setProperty(ID::status, static_cast<int>(AdapterStatus::PoweredOn), nullptr);
+            p->runOnMessageThread([pvt = p->valueTree, name, is_discovering = static_cast<bool>(org_bluez_adapter1_get_discovering(p->bluezAdapter))]() mutable
+                                  {
+                                      pvt.setProperty(ID::name, name, nullptr);
+                                      pvt.setProperty(ID::status, static_cast<int>(AdapterStatus::PoweredOn), nullptr);
+                                      pvt.setProperty(ID::is_discovering, is_discovering, nullptr);
+                                  });
 
             p->initializeObjectManager();
+
+            // Scans requested before the adapter was ready
+            p->updateScan();
         }
     };
 
@@ -813,55 +2668,176 @@ BleAdapter::Impl::Impl(ValueTree vt) : valueTree(std::move(vt))
             nullptr, // cancellable
             on_adapter_ready,
             this);
-
-    valueTree.addListener(this);
 }
 
-BleAdapter::Impl::~Impl()
+// Everything attached to the I/O context goes away on the I/O thread
+void BleAdapter::Impl::releaseResources()
 {
+    for (const auto& [address, cached]: gattDatabases)
+        if (!cached.database.services.empty())
+            gattCache.save(address, cached.database);
+
+    for (auto& [address, source]: awaitedDevices)
+        destroy_source(source);
+
+    gattDatabases.clear();
+    awaitedDevices.clear();
+    writePipelines.clear();
+    objectIndex.clear();
+    descriptorCache.clear();
+    characteristicCache.clear();
+    characteristicsByDevice.clear();
+    connections.clear();
+
+    if (dbusObjectManager != nullptr)
+        g_object_unref(dbusObjectManager);
+
     if (bluezAdapter != nullptr)
-    {
-        if (bluezAdapter != nullptr)
-            g_object_unref(bluezAdapter);
+        g_object_unref(bluezAdapter);
 
-        if (dbusObjectManager != nullptr)
-            g_object_unref(dbusObjectManager);
-    }
+    dbusObjectManager = nullptr;
+    bluezAdapter      = nullptr;
 }
 
 //======================================================================================================================
 BleAdapter::BleAdapter(ValueTree::Listener& l)
 {
     state.addListener(&l);
-    impl = std::make_unique<Impl>(state);
+    impl = std::make_unique<Impl>(state, deviceIndex, registry, knownDevices);
+
+    startTimer(500);
 }
 
-BleAdapter::BleAdapter() : impl(std::make_unique<Impl>(state)) { startTimer(500); }
+BleAdapter::BleAdapter() : impl(std::make_unique<Impl>(state, deviceIndex, registry, knownDevices)) { startTimer(500); }
 
 BleAdapter::~BleAdapter() = default;
 
 BleDevice BleAdapter::connect(const ValueTree& device, const BleDevice::Callbacks& callbacks) const
 {
-    impl->connect(device, callbacks);
+    impl->runOnIoThread([p = impl.get(), address = device.getProperty(ID::address).toString(), callbacks]
+                        { p->connect(address, callbacks); });
 
     return BleDevice(device);
 }
 
 void BleAdapter::disconnect(const BleDevice& device)
 {
-    impl->disconnect(device);
+    impl->runOnIoThread([p = impl.get(), address = device.state.getProperty(ID::address).toString()]
+                        { p->disconnect(address); });
+}
+
+size_t BleAdapter::getMaximumValueLength(const BleDevice& device)
+{
+    return static_cast<size_t>((int) device.state.getProperty(ID::max_pdu_size, Impl::DefaultAttMtu - 3));
+}
+
+void BleAdapter::scan(bool shouldStart, const std::initializer_list<juce::Uuid>& uuids, UpdatePolicy policy)
+{
+    juce::StringArray uuid_strs;
+
+    for (const auto& uuid: uuids)
+        uuid_strs.add(uuid.toDashedString());
+
+    impl->requestScan(shouldStart, std::move(uuid_strs), policy);
+}
+
+void BleAdapter::setMaxWritesInFlight(size_t withResponse, size_t withoutResponse)
+{
+    jassert(withResponse > 0 && withoutResponse > 0);
+
+    impl->maxWritesInFlightWithResponse    = std::max<size_t>(withResponse, 1);
+    impl->maxWritesInFlightWithoutResponse = std::max<size_t>(withoutResponse, 1);
+}
+
+size_t BleAdapter::getNumPendingWrites(const BleDevice& device) const
+{
+    return impl->getNumPendingWrites(device.state.getProperty(ID::address).toString());
+}
+
+void BleAdapter::setGattCacheDirectory(const File& directory)
+{
+    impl->runOnIoThread([p = impl.get(), directory] { p->gattCache.directory = directory; });
+}
+
+void BleAdapter::setCompactScanning(bool shouldBeCompact)
+{
+    impl->compactScanning = shouldBeCompact;
 }
 
-size_t BleAdapter::getMaximumValueLength(const BleDevice&)
+void BleAdapter::setAdvertisementCallback(AdvertisementCallback callback)
 {
-    jassertfalse;
-    return 0;
+    impl->runOnIoThread([p = impl.get(), callback = std::move(callback)]() mutable
+                        { p->advertisementCallback = std::move(callback); });
 }
 
 //======================================================================================================================
 void BleDevice::write(BleAdapter& adapter, const Uuid& uuid, gsl::span<const gsl::byte> data, bool withResponse)
 {
-    adapter.impl->writeCharacteristic(*this, uuid, data, withResponse);
+    auto* p = adapter.impl.get();
+
+    if (p->ioThread == nullptr)
+    {
+        p->writeCharacteristic(state.getProperty(ID::address).toString(), uuid, data, withResponse);
+        return;
+    }
+
+    p->runOnIoThread([p, address = state.getProperty(ID::address).toString(), uuid, buf = std::vector<gsl::byte>(data.begin(), data.end()), withResponse]
+                     { p->writeCharacteristic(address, uuid, buf, withResponse); });
+}
+
+void BleDevice::setWriteCoalescing(BleAdapter& adapter, WriteCoalescing coalescing)
+{
+    adapter.impl->runOnIoThread([p = adapter.impl.get(), address = state.getProperty(ID::address).toString(), coalescing = std::move(coalescing)]() mutable
+                                { p->setWriteCoalescing(address, std::move(coalescing)); });
+}
+
+void BleDevice::setNotificationRing(BleAdapter& adapter, const Uuid& uuid, std::shared_ptr<NotificationRing> ring)
+{
+    adapter.impl->runOnIoThread([p = adapter.impl.get(), address = state.getProperty(ID::address).toString(), uuid, ring = std::move(ring)]() mutable
+                                { p->setNotificationRing(address, uuid, std::move(ring)); });
+}
+
+void BleDevice::discoverServices(BleAdapter& adapter)
+{
+    adapter.impl->requestServiceDiscovery(state);
+}
+
+void BleDevice::discoverAll(BleAdapter& adapter)
+{
+    adapter.impl->requestFullDiscovery(state);
+}
+
+void BleDevice::discoverCharacteristics(BleAdapter& adapter, const Uuid& serviceUuid)
+{
+    if (const auto service = state.getChildWithProperty(ID::uuid, serviceUuid.toDashedString()); service.isValid())
+        adapter.impl->requestCharacteristicDiscovery(service);
+}
+
+void BleDevice::enableNotifications(BleAdapter& adapter, const Uuid& uuid, bool acquire)
+{
+    adapter.impl->runOnIoThread([p = adapter.impl.get(), address = state.getProperty(ID::address).toString(), uuid, acquire]
+                                {
+                                    if (const auto it = p->findCharacteristic(address, uuid); it != p->characteristicCache.end())
+                                        p->enableNotifications(it->first, acquire);
+                                });
+}
+
+void BleDevice::readDescriptor(BleAdapter& adapter, const Uuid& charact, const Uuid& descriptor)
+{
+    adapter.impl->runOnIoThread([p = adapter.impl.get(), address = state.getProperty(ID::address).toString(), charact, descriptor]
+                                {
+                                    if (const auto it = p->findDescriptor(address, charact, descriptor); it != p->descriptorCache.end())
+                                        p->readDescriptor(it->first);
+                                });
+}
+
+void BleDevice::writeDescriptor(BleAdapter& adapter, const Uuid& charact, const Uuid& descriptor, gsl::span<const gsl::byte> data)
+{
+    adapter.impl->runOnIoThread([p = adapter.impl.get(), address = state.getProperty(ID::address).toString(), charact, descriptor, buf = std::vector<gsl::byte>(data.begin(), data.end())]
+                                {
+                                    if (const auto it = p->findDescriptor(address, charact, descriptor); it != p->descriptorCache.end())
+                                        p->writeDescriptor(it->first, buf);
+                                });
 }
 
 } // namespace genki
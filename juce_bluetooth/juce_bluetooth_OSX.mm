@@ -52,6 +52,8 @@ struct LambdaTimer : public juce::Timer
 @interface OSXAdapter () <CBCentralManagerDelegate, CBPeripheralDelegate>
 {
     ValueTree                                                               valueTree;
+    std::unique_ptr<genki::DeviceIndex>                                     deviceIndex;
+    std::unique_ptr<genki::AdvertisementThrottle>                           advertisements;
     CriticalSection                                                         peripheralsLock;
     std::map<String, std::pair<CBPeripheral*, genki::BleDevice::Callbacks>> peripherals;
 }
@@ -68,6 +70,8 @@ struct LambdaTimer : public juce::Timer
     self = [super init];
 
     valueTree = vt;
+    deviceIndex = std::make_unique<genki::DeviceIndex>(valueTree);
+    advertisements = std::make_unique<genki::AdvertisementThrottle>(valueTree);
 
     return self;
 }
@@ -102,7 +106,7 @@ struct LambdaTimer : public juce::Timer
     const auto max_pdu      = (int) [self getMaximumValueLengthForPeripheral:peripheral];
     const auto now          = (int) Time::getMillisecondCounter();
 
-    if (auto ch = valueTree.getChildWithProperty(ID::address, addr_str); ch.isValid())
+    if (auto ch = deviceIndex->find(addr_str); ch.isValid())
     {
         ch.setProperty(ID::is_connected, is_connected, nullptr);
         ch.setProperty(ID::max_pdu_size, max_pdu, nullptr);
@@ -147,7 +151,7 @@ didDisconnectPeripheral:(nonnull CBPeripheral*)peripheral
         peripherals.erase(it);
     }
 
-    valueTree.removeChild(valueTree.getChildWithProperty(ID::address, addr_str), nullptr);
+    valueTree.removeChild(deviceIndex->find(addr_str), nullptr);
 }
 
 - (void)centralManager:(nonnull CBCentralManager*)central didDiscoverPeripheral:(nonnull CBPeripheral*)peripheral
@@ -177,7 +181,7 @@ didDisconnectPeripheral:(nonnull CBPeripheral*)peripheral
 
     const auto addr_str = get_address_string([peripheral identifier]);
 
-    for (const auto& vt: valueTree.getChildWithProperty(ID::address, addr_str))
+    for (const auto& vt: deviceIndex->find(addr_str))
         if (vt.hasType(ID::SERVICE))
             if (auto ch = vt.getChildWithProperty(ID::uuid, get_uuid_string([characteristic UUID])); ch.isValid())
                 genki::message(ch, {ID::NOTIFICATIONS_ARE_ENABLED, {}});
@@ -186,7 +190,7 @@ didDisconnectPeripheral:(nonnull CBPeripheral*)peripheral
 - (void)peripheral:(nonnull CBPeripheral*)peripheral didDiscoverServices:(nullable NSError*)error {
 
     const auto addr_str = get_address_string([peripheral identifier]);
-    auto       vt       = valueTree.getChildWithProperty(ID::address, addr_str);
+    auto       vt       = deviceIndex->find(addr_str);
 
     const NSArray<CBService*>* cb_services = [peripheral services];
 
@@ -203,7 +207,7 @@ didDisconnectPeripheral:(nonnull CBPeripheral*)peripheral
     const auto addr_str     = get_address_string([peripheral identifier]);
     const auto service_uuid = get_uuid_string([service UUID]);
 
-    auto vt = valueTree.getChildWithProperty(ID::address, addr_str).getChildWithProperty(ID::uuid, service_uuid);
+    auto vt = deviceIndex->find(addr_str).getChildWithProperty(ID::uuid, service_uuid);
 
     jassert(vt.isValid() && vt.hasType(ID::SERVICE));
 
@@ -216,6 +220,7 @@ didDisconnectPeripheral:(nonnull CBPeripheral*)peripheral
                 {ID::uuid, get_uuid_string([charact UUID])},
                 {ID::can_write_with_response, static_cast<bool>(charact.properties >> CBCharacteristicPropertyWrite)},
                 {ID::can_write_without_response, static_cast<bool>(charact.properties >> CBCharacteristicPropertyWriteWithoutResponse)},
+                {ID::properties, static_cast<int>(charact.properties & 0xff)},
         }}, nullptr);
     }
 }
@@ -307,7 +312,7 @@ didDisconnectPeripheral:(nonnull CBPeripheral*)peripheral
         [self.centralManager cancelPeripheralConnection:it->second.first];
 
         peripherals.erase(it);
-        valueTree.removeChild(valueTree.getChildWithProperty(ID::address, address), nullptr);
+        valueTree.removeChild(deviceIndex->find(address), nullptr);
     }
 }
 
@@ -328,13 +333,9 @@ didDisconnectPeripheral:(nonnull CBPeripheral*)peripheral
 
     const auto now = (int) Time::getMillisecondCounter();
 
-    if (auto ch = valueTree.getChildWithProperty(ID::address, addr_str); ch.isValid())
+    if (auto ch = deviceIndex->find(addr_str); ch.isValid())
     {
-        ch.setProperty(ID::rssi, rssi, nullptr);
-        if (name.isNotEmpty())
-            ch.setProperty(ID::name, name, nullptr);
-
-        ch.setProperty(ID::last_seen, now, nullptr);
+        advertisements->deviceSeen(ch, addr_str, rssi, name, now);
     }
     else
     {
@@ -353,6 +354,10 @@ didDisconnectPeripheral:(nonnull CBPeripheral*)peripheral
     }
 }
 
+- (void)setUpdatePolicy:(genki::AdvertisementThrottle::Policy)policy {
+    advertisements->setPolicy(policy);
+}
+
 - (void)pollPduSizes {
     const ScopedLock lock(peripheralsLock);
 
@@ -362,7 +367,7 @@ didDisconnectPeripheral:(nonnull CBPeripheral*)peripheral
 
         const auto addr_str = get_address_string([peripheral identifier]);
 
-        if (auto ch = valueTree.getChildWithProperty(ID::address, addr_str); ch.isValid())
+        if (auto ch = deviceIndex->find(addr_str); ch.isValid())
             ch.setProperty(ID::max_pdu_size, static_cast<int>([self getMaximumValueLengthForPeripheral:peripheral]), nullptr);
     }
 }
@@ -459,6 +464,8 @@ struct BleAdapter::Impl : private ValueTree::Listener
             {
                 using namespace ranges;
 
+                [adapter setUpdatePolicy:genki::AdvertisementThrottle::getPolicy(child)];
+
                 const auto rng       = ValueTreeRange(child);
                 const auto uuid_strs = rng | views::transform(property_as<String>(ID::uuid));
 
@@ -525,6 +532,8 @@ BleAdapter::BleAdapter(ValueTree::Listener& l)
     state.addListener(&l);
 
     impl = std::make_unique<Impl>(state);
+
+    startTimer(500);
 }
 
 BleAdapter::BleAdapter() : impl(std::make_unique<Impl>(state)) { startTimer(500); }
@@ -558,6 +567,36 @@ size_t BleAdapter::getMaximumValueLength(const BleDevice& device)
     return 0;
 }
 
+void BleAdapter::setMaxWritesInFlight(size_t, size_t)
+{
+    // CoreBluetooth queues writes internally
+}
+
+void BleAdapter::scan(bool shouldStart, const std::initializer_list<juce::Uuid>& uuids, UpdatePolicy policy)
+{
+    message(state, makeScanMessage(shouldStart, uuids, policy));
+}
+
+size_t BleAdapter::getNumPendingWrites(const BleDevice&) const
+{
+    return 0;
+}
+
+void BleAdapter::setAdvertisementCallback(AdvertisementCallback)
+{
+    // Only supported on Linux
+}
+
+void BleAdapter::setCompactScanning(bool)
+{
+    // Only supported on Linux, every scanned device gets a node
+}
+
+void BleAdapter::setGattCacheDirectory(const File&)
+{
+    // Only supported on Linux
+}
+
 //======================================================================================================================
 void BleDevice::write(BleAdapter& adapter, const Uuid& charactUuid, gsl::span<const gsl::byte> data, bool withResponse)
 {
@@ -567,6 +606,51 @@ void BleDevice::write(BleAdapter& adapter, const Uuid& charactUuid, gsl::span<co
                 adapter.impl->write(c, data, withResponse);
 }
 
+// The typed commands go through the ValueTree messages on this platform
+void BleDevice::discoverServices(BleAdapter&)
+{
+    message(state, ID::DISCOVER_SERVICES);
+}
+
+void BleDevice::discoverAll(BleAdapter&)
+{
+    message(state, ID::DISCOVER_ALL);
+}
+
+void BleDevice::discoverCharacteristics(BleAdapter&, const Uuid& serviceUuid)
+{
+    if (const auto service = state.getChildWithProperty(ID::uuid, serviceUuid.toDashedString()); service.isValid())
+        message(service, ID::DISCOVER_CHARACTERISTICS);
+}
+
+void BleDevice::enableNotifications(BleAdapter&, const Uuid& charactUuid, bool acquire)
+{
+    for (const auto& s: state)
+        if (s.hasType(ID::SERVICE))
+            if (const auto c = s.getChildWithProperty(ID::uuid, charactUuid.toDashedString()); c.isValid())
+                message(c, {ID::ENABLE_NOTIFICATIONS, {{ID::acquire, acquire}}});
+}
+
+void BleDevice::readDescriptor(BleAdapter&, const Uuid&, const Uuid&)
+{
+    // Only supported on Linux, descriptors aren't discovered
+}
+
+void BleDevice::writeDescriptor(BleAdapter&, const Uuid&, const Uuid&, gsl::span<const gsl::byte>)
+{
+    // Only supported on Linux, descriptors aren't discovered
+}
+
+void BleDevice::setWriteCoalescing(BleAdapter&, WriteCoalescing)
+{
+    // Only supported on Linux, writes are sent as they are
+}
+
+void BleDevice::setNotificationRing(BleAdapter&, const Uuid&, std::shared_ptr<NotificationRing>)
+{
+    // Only supported on Linux, notifications are delivered through valueChanged
+}
+
 } // namespace genki
 
 #ifdef __clang__
@@ -141,6 +141,7 @@ struct BleAdapter::Impl : private ValueTree::Listener
 
     //==================================================================================================================
     ValueTree valueTree;
+    DeviceIndex deviceIndex{valueTree};
 
     //==================================================================================================================
     juce::CriticalSection                         advertisementLock;
@@ -214,7 +215,7 @@ BleAdapter::Impl::Impl(ValueTree vt)
             const auto device = sender.GetResults();
             jassert(device != nullptr);
 
-            const auto ch = valueTree.getChildWithProperty(ID::address, winrt_util::to_mac_string(device.BluetoothAddress()));
+            const auto ch = deviceIndex.find(winrt_util::to_mac_string(device.BluetoothAddress()));
             valueTree.removeChild(ch, nullptr);
         }); });
 
@@ -386,7 +387,7 @@ void BleAdapter::Impl::deviceDiscovered(const AdvertisementInfo& info)
     const String name         = winrt::to_string(info.name);
     const bool   is_connected = false; // TODO: Does this apply?
 
-    if (auto ch = valueTree.getChildWithProperty(ID::address, winrt_util::to_mac_string(info.address)); ch.isValid())
+    if (auto ch = deviceIndex.find(winrt_util::to_mac_string(info.address)); ch.isValid())
     {
         ch.setProperty(ID::rssi, info.rssi, nullptr);
         ch.setProperty(ID::name, name, nullptr);
@@ -660,6 +661,7 @@ void BleAdapter::Impl::discoverCharacteristics(const ValueTree& vt)
                                 {ID::uuid, winrt_util::guid_to_uuid(c.Uuid()).toDashedString()},
                                 {ID::can_write_with_response, test_property(GattCharacteristicProperties::Write)},
                                 {ID::can_write_without_response, test_property(GattCharacteristicProperties::WriteWithoutResponse)},
+                                {ID::properties, static_cast<int>(static_cast<uint32_t>(c.CharacteristicProperties()) & 0xff)},
                             }}, nullptr);
                         }
                     }
@@ -747,6 +749,8 @@ BleAdapter::BleAdapter(ValueTree::Listener& l)
     state.addListener(&l);
 
     impl = std::make_unique<Impl>(state);
+
+    startTimer(500);
 }
 
 BleAdapter::BleAdapter() : impl(std::make_unique<Impl>(state)) { startTimer(500); }
@@ -786,6 +790,44 @@ size_t BleAdapter::getMaximumValueLength(const BleDevice& device)
     return static_cast<size_t>((int) device.state.getProperty(ID::max_pdu_size, 0));
 }
 
+void BleAdapter::setMaxWritesInFlight(size_t, size_t)
+{
+    // Writes are always issued one at a time on Windows
+}
+
+void BleAdapter::scan(bool shouldStart, const std::initializer_list<juce::Uuid>& uuids, UpdatePolicy policy)
+{
+    message(state, makeScanMessage(shouldStart, uuids, policy));
+}
+
+size_t BleAdapter::getNumPendingWrites(const BleDevice& device) const
+{
+    const ScopedLock lock(impl->devicesLock);
+
+    if (const auto it = impl->devices.find(get_address(device.state)); it != impl->devices.end())
+    {
+        const ScopedLock wLock(it->second.writeLock);
+        return it->second.writes.size();
+    }
+
+    return 0;
+}
+
+void BleAdapter::setAdvertisementCallback(AdvertisementCallback)
+{
+    // Only supported on Linux
+}
+
+void BleAdapter::setCompactScanning(bool)
+{
+    // Only supported on Linux, every scanned device gets a node
+}
+
+void BleAdapter::setGattCacheDirectory(const File&)
+{
+    // Only supported on Linux
+}
+
 //======================================================================================================================
 void BleDevice::write(BleAdapter& adapter, const Uuid& charactUuid, gsl::span<const gsl::byte> data, bool withResponse)
 {
@@ -795,6 +837,51 @@ void BleDevice::write(BleAdapter& adapter, const Uuid& charactUuid, gsl::span<co
                 adapter.impl->write(c, data, withResponse);
 }
 
+// The typed commands go through the ValueTree messages on this platform
+void BleDevice::discoverServices(BleAdapter&)
+{
+    message(state, ID::DISCOVER_SERVICES);
+}
+
+void BleDevice::discoverAll(BleAdapter&)
+{
+    message(state, ID::DISCOVER_ALL);
+}
+
+void BleDevice::discoverCharacteristics(BleAdapter&, const Uuid& serviceUuid)
+{
+    if (const auto service = state.getChildWithProperty(ID::uuid, serviceUuid.toDashedString()); service.isValid())
+        message(service, ID::DISCOVER_CHARACTERISTICS);
+}
+
+void BleDevice::enableNotifications(BleAdapter&, const Uuid& charactUuid, bool acquire)
+{
+    for (const auto& s: state)
+        if (s.hasType(ID::SERVICE))
+            if (const auto c = s.getChildWithProperty(ID::uuid, charactUuid.toDashedString()); c.isValid())
+                message(c, {ID::ENABLE_NOTIFICATIONS, {{ID::acquire, acquire}}});
+}
+
+void BleDevice::readDescriptor(BleAdapter&, const Uuid&, const Uuid&)
+{
+    // Only supported on Linux, descriptors aren't discovered
+}
+
+void BleDevice::writeDescriptor(BleAdapter&, const Uuid&, const Uuid&, gsl::span<const gsl::byte>)
+{
+    // Only supported on Linux, descriptors aren't discovered
+}
+
+void BleDevice::setWriteCoalescing(BleAdapter&, WriteCoalescing)
+{
+    // Only supported on Linux, writes are sent as they are
+}
+
+void BleDevice::setNotificationRing(BleAdapter&, const Uuid&, std::shared_ptr<NotificationRing>)
+{
+    // Only supported on Linux, notifications are delivered through valueChanged
+}
+
 } // namespace genki
 
 #pragma warning(pop)
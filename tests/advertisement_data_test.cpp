@@ -0,0 +1,101 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+namespace genki {
+
+class AdvertisementDataTest : public juce::UnitTest
+{
+public:
+    AdvertisementDataTest() : juce::UnitTest("AdvertisementData", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        const juce::Uuid service("0000180d-0000-1000-8000-00805f9b34fb");
+        const juce::Uuid other("0000180f-0000-1000-8000-00805f9b34fb");
+
+        const auto service_bytes = AdvertisementData::toLittleEndian(service);
+        const auto company_bytes = bytes({0x4c, 0x00});
+        const auto payload       = bytes({0xde, 0xad, 0xbe, 0xef});
+        const auto tx_power      = bytes({0xf4});
+
+        beginTest("Encoded fields are found again");
+        {
+            std::vector<gsl::byte> record;
+            AdvertisementData::append(record, AdvertisementData::ServiceUuids, {service_bytes});
+            AdvertisementData::append(record, AdvertisementData::TxPowerLevel, {tx_power});
+            AdvertisementData::append(record, AdvertisementData::ManufacturerSpecific, {company_bytes, payload});
+            AdvertisementData::append(record, AdvertisementData::ServiceData, {service_bytes, payload});
+
+            const AdvertisementData ad(record);
+
+            expect(ad.hasServiceUuid(service));
+            expect(!ad.hasServiceUuid(other));
+            expectEquals(static_cast<int>(ad.getTxPower().value_or(0)), -12);
+            expect(equal(ad.getManufacturerData(0x004c), payload));
+            expect(ad.getManufacturerData(0x0006).empty());
+            expect(equal(ad.getServiceData(service), payload));
+            expect(ad.getServiceData(other).empty());
+        }
+
+        beginTest("The record round-trips through the device node");
+        {
+            std::vector<gsl::byte> record;
+            AdvertisementData::append(record, AdvertisementData::TxPowerLevel, {tx_power});
+
+            juce::ValueTree device(ID::BLUETOOTH_DEVICE);
+            device.setProperty(ID::advertisement, juce::MemoryBlock(record.data(), record.size()), nullptr);
+
+            expect(equal(AdvertisementData::fromDevice(device).getRecord(), record));
+            expect(AdvertisementData::fromDevice(juce::ValueTree(ID::BLUETOOTH_DEVICE)).getRecord().empty());
+        }
+
+        beginTest("Structures are cut off at 254 bytes of payload");
+        {
+            std::vector<gsl::byte> record;
+            AdvertisementData::append(record, AdvertisementData::ManufacturerSpecific, {company_bytes, std::vector<gsl::byte>(300)});
+
+            expectEquals(record.size(), size_t{256});
+            expectEquals(static_cast<int>(record[0]), 255);
+        }
+
+        beginTest("A truncated record stops at the last complete structure");
+        {
+            std::vector<gsl::byte> record;
+            AdvertisementData::append(record, AdvertisementData::TxPowerLevel, {tx_power});
+            AdvertisementData::append(record, AdvertisementData::ManufacturerSpecific, {company_bytes, payload});
+            record.pop_back();
+
+            int num_structures = 0;
+            AdvertisementData(record).forEach([&](uint8_t, auto) { ++num_structures; });
+
+            expectEquals(num_structures, 1);
+        }
+
+        beginTest("UUID strings parse into little-endian bytes");
+        {
+            std::array<gsl::byte, 16> parsed{};
+
+            expect(AdvertisementData::parseUuid(service.toDashedString().toStdString(), parsed));
+            expect(parsed == service_bytes);
+            expect(!AdvertisementData::parseUuid("0000180d-0000", parsed));
+            expect(!AdvertisementData::parseUuid("0000180d-0000-1000-8000-00805f9b34fbaa", parsed));
+            expect(!AdvertisementData::parseUuid("0000180d-0000-1000-8000-00805f9b34fz", parsed));
+        }
+    }
+
+private:
+    static std::vector<gsl::byte> bytes(std::initializer_list<uint8_t> values)
+    {
+        std::vector<gsl::byte> v;
+
+        for (const auto b: values)
+            v.push_back(static_cast<gsl::byte>(b));
+
+        return v;
+    }
+
+    static bool equal(gsl::span<const gsl::byte> a, gsl::span<const gsl::byte> b) { return std::equal(a.begin(), a.end(), b.begin(), b.end()); }
+};
+
+static AdvertisementDataTest advertisementDataTest;
+
+} // namespace genki
@@ -0,0 +1,102 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+namespace genki {
+
+class AdvertisementThrottleTest : public juce::UnitTest
+{
+public:
+    AdvertisementThrottleTest() : juce::UnitTest("AdvertisementThrottle", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        const juce::String address("aa:bb:cc:01:02:03");
+
+        juce::ValueTree state(ID::BLUETOOTH_ADAPTER);
+        juce::ValueTree device(ID::BLUETOOTH_DEVICE, {{ID::address, address}, {ID::rssi, -50}, {ID::last_seen, 0}});
+        state.appendChild(device, nullptr);
+
+        AdvertisementThrottle throttle(state);
+
+        beginTest("Without a policy every advertisement is published");
+        {
+            throttle.deviceSeen(device, address, -55, "", 100);
+
+            expectEquals(static_cast<int>(device.getProperty(ID::rssi)), -55);
+            expectEquals(static_cast<int>(device.getProperty(ID::last_seen)), 100);
+        }
+
+        beginTest("Advertisements within the interval are coalesced");
+        {
+            throttle.setPolicy({1000, 5});
+
+            throttle.deviceSeen(device, address, -60, "", 500);
+            throttle.deviceSeen(device, address, -70, "Sensor", 800);
+
+            expectEquals(static_cast<int>(device.getProperty(ID::rssi)), -55);
+            expectEquals(static_cast<int>(device.getProperty(ID::last_seen)), 100);
+        }
+
+        beginTest("Held back values are published with their latest values");
+        {
+            throttle.setPolicy({0, 5});
+
+            expectEquals(static_cast<int>(device.getProperty(ID::rssi)), -70);
+            expectEquals(device.getProperty(ID::name).toString(), juce::String("Sensor"));
+            expectEquals(static_cast<int>(device.getProperty(ID::last_seen)), 800);
+        }
+
+        beginTest("RSSI changes below the delta are not published");
+        {
+            throttle.deviceSeen(device, address, -72, "", 900);
+
+            expectEquals(static_cast<int>(device.getProperty(ID::rssi)), -70);
+            expectEquals(static_cast<int>(device.getProperty(ID::last_seen)), 900);
+        }
+
+        beginTest("Advertisement records are coalesced with the rest");
+        {
+            throttle.setPolicy({1000, 5});
+
+            throttle.advertisementChanged(device, address, juce::MemoryBlock("\x01\x02", 2), 1200);
+            throttle.advertisementChanged(device, address, juce::MemoryBlock("\x03", 1), 1500);
+            expect(device.getProperty(ID::advertisement).isVoid());
+
+            throttle.setPolicy({0, 5});
+
+            const auto* record = device.getProperty(ID::advertisement).getBinaryData();
+            expect(record != nullptr && *record == juce::MemoryBlock("\x03", 1));
+        }
+
+        beginTest("With a policy last_seen is only published when the device gets close to expiring");
+        {
+            state.setProperty(ID::device_timeout, 10000, nullptr);
+
+            throttle.deviceSeen(device, address, -90, "", 4000);
+            expectEquals(static_cast<int>(device.getProperty(ID::rssi)), -90);
+            expectEquals(static_cast<int>(device.getProperty(ID::last_seen)), 900);
+
+            throttle.deviceSeen(device, address, -90, "", 5900);
+            expectEquals(static_cast<int>(device.getProperty(ID::last_seen)), 5900);
+
+            throttle.setPolicy({});
+            throttle.deviceSeen(device, address, -90, "", 6000);
+            expectEquals(static_cast<int>(device.getProperty(ID::last_seen)), 6000);
+
+            state.removeProperty(ID::device_timeout, nullptr);
+        }
+
+        beginTest("The policy round-trips through the scan message");
+        {
+            juce::ValueTree message(ID::SCAN);
+            AdvertisementThrottle::setPolicy(message, {250, 3});
+
+            const auto policy = AdvertisementThrottle::getPolicy(message);
+            expectEquals(policy.minIntervalMs, 250);
+            expectEquals(policy.minRssiDelta, 3);
+        }
+    }
+};
+
+static AdvertisementThrottleTest advertisementThrottleTest;
+
+} // namespace genki
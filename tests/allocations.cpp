@@ -0,0 +1,39 @@
+#include "allocations.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+std::atomic<size_t>  numAllocations{0};
+std::atomic<int64_t> numLiveBytes{0};
+
+// Every block starts with its size, so that delete can account for it
+static constexpr size_t HeaderSize = alignof(std::max_align_t);
+
+void* operator new(size_t size)
+{
+    numAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (auto* block = static_cast<char*>(std::malloc(HeaderSize + size)))
+    {
+        *reinterpret_cast<size_t*>(block) = size;
+        numLiveBytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed);
+
+        return block + HeaderSize;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr == nullptr)
+        return;
+
+    auto* block = static_cast<char*>(ptr) - HeaderSize;
+
+    numLiveBytes.fetch_sub(static_cast<int64_t>(*reinterpret_cast<size_t*>(block)), std::memory_order_relaxed);
+    std::free(block);
+}
+
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
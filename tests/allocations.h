@@ -0,0 +1,10 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+//======================================================================================================================
+// Counters of the operator new replacement in allocations.cpp, for tests that show code doesn't allocate or measure how
+// much memory it keeps
+extern std::atomic<size_t>  numAllocations;
+extern std::atomic<int64_t> numLiveBytes;
@@ -0,0 +1,105 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+#if JUCE_LINUX
+
+#include "dbus_peer.h"
+#include "native/linux/bluez_utils.h"
+#include "native/linux/object_paths.h"
+
+namespace genki {
+
+// Characteristic proxies are created once at discovery and looked up by object path for every operation. The lookup
+// is timed against creating the proxy per call, on a peer connection so that neither needs BlueZ.
+class CharacteristicProxyTest : public juce::UnitTest
+{
+public:
+    CharacteristicProxyTest() : juce::UnitTest("CharacteristicProxy", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        constexpr int NumCharacteristics = 64;
+        constexpr int NumCalls           = 10000;
+
+        DBusPeer peer;
+
+        beginTest("Proxies are created without a bus round-trip");
+        {
+            expect(peer.connection != nullptr);
+            expect(createProxy(peer, characteristicPath(0)) != nullptr);
+        }
+
+        beginTest("Looking up the cached proxy vs creating one per call");
+        {
+            std::vector<std::string>           paths;
+            ObjectPathMap<CharacteristicProxy> cache;
+
+            for (int i = 0; i < NumCharacteristics; ++i)
+            {
+                paths.push_back(characteristicPath(i));
+                cache.try_emplace(paths.back(), createProxy(peer, paths.back()));
+            }
+
+            int num_found = 0;
+
+            auto start = juce::Time::getHighResolutionTicks();
+
+            for (int i = 0; i < NumCalls; ++i)
+            {
+                // Note: Signal handlers and commands look up by string_view, without building a std::string
+                const auto it = cache.find(std::string_view(paths[static_cast<size_t>(i % NumCharacteristics)]));
+
+                if (it != cache.end() && it->second != nullptr)
+                    ++num_found;
+            }
+
+            const auto lookup_time = juce::Time::getHighResolutionTicks() - start;
+
+            int num_created = 0;
+
+            start = juce::Time::getHighResolutionTicks();
+
+            for (int i = 0; i < NumCalls; ++i)
+                if (createProxy(peer, paths[static_cast<size_t>(i % NumCharacteristics)]) != nullptr)
+                    ++num_created;
+
+            const auto create_time = juce::Time::getHighResolutionTicks() - start;
+
+            expectEquals(num_found, NumCalls);
+            expectEquals(num_created, NumCalls);
+
+            logMessage(nsPerCall(lookup_time, NumCalls) + " ns per cached proxy lookup");
+            logMessage(nsPerCall(create_time, NumCalls) + " ns per proxy created and released");
+        }
+    }
+
+private:
+    static std::string characteristicPath(int index)
+    {
+        return juce::String::formatted("/org/bluez/hci0/dev_00_11_22_33_44_55/service0010/char%04x", index + 0x11).toStdString();
+    }
+
+    // Same flags as bluez_utils::get_characteristic_proxy(), a peer connection has no bus names
+    static CharacteristicProxy createProxy(const DBusPeer& peer, const std::string& path)
+    {
+        auto* proxy = org_bluez_gatt_characteristic1_proxy_new_sync(
+                peer.connection,
+                static_cast<GDBusProxyFlags>(G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES | G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS),
+                nullptr,
+                path.c_str(),
+                nullptr,
+                nullptr);
+
+        return CharacteristicProxy(proxy, g_object_unref);
+    }
+
+    static juce::String nsPerCall(int64_t ticks, int num_calls)
+    {
+        return juce::String(juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e9 / static_cast<double>(num_calls), 1);
+    }
+};
+
+static CharacteristicProxyTest characteristicProxyTest;
+
+} // namespace genki
+
+#endif
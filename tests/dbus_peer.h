@@ -0,0 +1,48 @@
+#pragma once
+
+#include <gio/gio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace genki {
+
+//======================================================================================================================
+// Private D-Bus connection over a socketpair, without a bus daemon or authentication. Proxies can be created on it
+// with a null bus name and the D-Bus calls of the backend timed without BlueZ. Nothing answers on the other end.
+struct DBusPeer
+{
+    DBusPeer()
+    {
+        int fds[2] = {-1, -1};
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+        peerFd = fds[1];
+
+        GSocket*           socket = g_socket_new_from_fd(fds[0], nullptr);
+        GSocketConnection* stream = g_socket_connection_factory_create_connection(socket);
+
+        connection = g_dbus_connection_new_sync(G_IO_STREAM(stream), nullptr, G_DBUS_CONNECTION_FLAGS_NONE, nullptr, nullptr, nullptr);
+
+        g_object_unref(stream);
+        g_object_unref(socket);
+    }
+
+    ~DBusPeer()
+    {
+        if (connection != nullptr)
+        {
+            g_dbus_connection_close_sync(connection, nullptr, nullptr);
+            g_object_unref(connection);
+        }
+
+        close(peerFd);
+    }
+
+    DBusPeer(const DBusPeer&)            = delete;
+    DBusPeer& operator=(const DBusPeer&) = delete;
+
+    GDBusConnection* connection = nullptr;
+    int              peerFd     = -1;
+};
+
+} // namespace genki
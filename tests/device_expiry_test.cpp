@@ -0,0 +1,128 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+namespace genki {
+
+class DeviceExpiryTest : public juce::UnitTest
+{
+public:
+    DeviceExpiryTest() : juce::UnitTest("DeviceExpiry", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        const auto add_device = [](juce::ValueTree& state, const juce::String& address, int lastSeen)
+        {
+            juce::ValueTree device(ID::BLUETOOTH_DEVICE, {{ID::address, address}, {ID::last_seen, lastSeen}, {ID::is_connected, false}});
+            state.appendChild(device, nullptr);
+            return device;
+        };
+
+        beginTest("Devices not seen within the timeout are removed");
+        {
+            juce::ValueTree state(ID::BLUETOOTH_ADAPTER);
+            DeviceExpiry    expiry(state, 1000);
+
+            add_device(state, "aa:bb:cc:01:02:03", 0);
+            add_device(state, "aa:bb:cc:01:02:04", 800);
+
+            expiry.removeExpired(1000);
+            expectEquals(state.getNumChildren(), 2);
+
+            expiry.removeExpired(1500);
+            expectEquals(state.getNumChildren(), 1);
+            expectEquals(state.getChild(0).getProperty(ID::address).toString(), juce::String("aa:bb:cc:01:02:04"));
+        }
+
+        beginTest("Devices seen again get a new deadline");
+        {
+            juce::ValueTree state(ID::BLUETOOTH_ADAPTER);
+            DeviceExpiry    expiry(state, 1000);
+
+            auto device = add_device(state, "aa:bb:cc:01:02:03", 0);
+            device.setProperty(ID::last_seen, 900, nullptr);
+
+            expiry.removeExpired(1500);
+            expectEquals(state.getNumChildren(), 1);
+
+            expiry.removeExpired(2000);
+            expectEquals(state.getNumChildren(), 0);
+        }
+
+        beginTest("Connected devices stay until they disconnect");
+        {
+            juce::ValueTree state(ID::BLUETOOTH_ADAPTER);
+            DeviceExpiry    expiry(state, 1000);
+
+            auto device = add_device(state, "aa:bb:cc:01:02:03", 0);
+            device.setProperty(ID::is_connected, true, nullptr);
+
+            expiry.removeExpired(5000);
+            expectEquals(state.getNumChildren(), 1);
+
+            device.setProperty(ID::last_seen, 5000, nullptr);
+            device.setProperty(ID::is_connected, false, nullptr);
+
+            expiry.removeExpired(5500);
+            expectEquals(state.getNumChildren(), 1);
+
+            expiry.removeExpired(6500);
+            expectEquals(state.getNumChildren(), 0);
+        }
+
+        beginTest("Only the latest deadline of a device counts");
+        {
+            juce::ValueTree state(ID::BLUETOOTH_ADAPTER);
+            DeviceExpiry    expiry(state, 1000);
+
+            auto device = add_device(state, "aa:bb:cc:01:02:03", 0);
+
+            for (int i = 0; i < 100; ++i)
+            {
+                device.setProperty(ID::is_connected, true, nullptr);
+                device.setProperty(ID::is_connected, false, nullptr);
+            }
+
+            device.setProperty(ID::last_seen, 2000, nullptr);
+            device.setProperty(ID::is_connected, true, nullptr);
+            device.setProperty(ID::is_connected, false, nullptr);
+
+            expiry.removeExpired(2500);
+            expectEquals(state.getNumChildren(), 1);
+
+            expiry.removeExpired(3500);
+            expectEquals(state.getNumChildren(), 0);
+        }
+
+        beginTest("A device added again under the same address gets its own deadline");
+        {
+            juce::ValueTree state(ID::BLUETOOTH_ADAPTER);
+            DeviceExpiry    expiry(state, 1000);
+
+            state.removeChild(add_device(state, "aa:bb:cc:01:02:03", 0), nullptr);
+            add_device(state, "aa:bb:cc:01:02:03", 900);
+
+            expiry.removeExpired(1500);
+            expectEquals(state.getNumChildren(), 1);
+
+            expiry.removeExpired(2000);
+            expectEquals(state.getNumChildren(), 0);
+        }
+
+        beginTest("A new timeout applies to the devices already there");
+        {
+            juce::ValueTree state(ID::BLUETOOTH_ADAPTER);
+            DeviceExpiry    expiry(state, 10000);
+
+            add_device(state, "aa:bb:cc:01:02:03", 0);
+
+            expiry.setTimeout(100);
+            expectEquals(expiry.getTimeout(), 100);
+
+            expiry.removeExpired(200);
+            expectEquals(state.getNumChildren(), 0);
+        }
+    }
+};
+
+static DeviceExpiryTest deviceExpiryTest;
+
+} // namespace genki
@@ -0,0 +1,101 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+namespace genki {
+
+class DeviceIndexTest : public juce::UnitTest
+{
+public:
+    DeviceIndexTest() : juce::UnitTest("DeviceIndex", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        beginTest("Devices are found as they are added and not once removed");
+        {
+            juce::ValueTree state(ID::BLUETOOTH_ADAPTER);
+            state.appendChild(makeDevice(0), nullptr);
+
+            DeviceIndex index(state);
+
+            auto device = makeDevice(1);
+            state.appendChild(device, nullptr);
+
+            expect(index.find(address(0)).isValid());
+            expect(index.find(address(1)) == device);
+
+            state.removeChild(device, nullptr);
+            expect(!index.find(address(1)).isValid());
+        }
+
+        beginTest("A replaced node stays indexed when the old one is removed");
+        {
+            juce::ValueTree state(ID::BLUETOOTH_ADAPTER);
+            DeviceIndex     index(state);
+
+            const auto stale = makeDevice(0);
+            const auto fresh = makeDevice(0);
+
+            state.appendChild(stale, nullptr);
+            state.appendChild(fresh, nullptr);
+            state.removeChild(stale, nullptr);
+
+            expect(index.find(address(0)) == fresh);
+        }
+
+        beginTest("Index lookup vs getChildWithProperty");
+        {
+            constexpr int NumDevices = 4096;
+            constexpr int NumLookups = 10000;
+
+            juce::ValueTree state(ID::BLUETOOTH_ADAPTER);
+            DeviceIndex     index(state);
+
+            for (int i = 0; i < NumDevices; ++i)
+                state.appendChild(makeDevice(i), nullptr);
+
+            juce::StringArray addresses;
+
+            for (int i = 0; i < NumLookups; ++i)
+                addresses.add(address((i * 7919) % NumDevices));
+
+            int num_found = 0;
+
+            auto start = juce::Time::getHighResolutionTicks();
+
+            for (const auto& addr: addresses)
+                if (index.find(addr).isValid())
+                    ++num_found;
+
+            const auto index_time = juce::Time::getHighResolutionTicks() - start;
+
+            start = juce::Time::getHighResolutionTicks();
+
+            for (const auto& addr: addresses)
+                if (state.getChildWithProperty(ID::address, addr).isValid())
+                    ++num_found;
+
+            const auto scan_time = juce::Time::getHighResolutionTicks() - start;
+
+            expectEquals(num_found, 2 * NumLookups);
+
+            logMessage(nsPerLookup(index_time, NumLookups) + " ns per index lookup, " + juce::String(NumDevices) + " devices");
+            logMessage(nsPerLookup(scan_time, NumLookups) + " ns per getChildWithProperty lookup, " + juce::String(NumDevices) + " devices");
+        }
+    }
+
+private:
+    static juce::String address(int i) { return juce::String::formatted("aa:bb:cc:dd:%02x:%02x", (i >> 8) & 0xff, i & 0xff); }
+
+    static juce::ValueTree makeDevice(int i)
+    {
+        return juce::ValueTree(ID::BLUETOOTH_DEVICE, {{ID::address, address(i)}, {ID::last_seen, 0}, {ID::is_connected, false}});
+    }
+
+    static juce::String nsPerLookup(int64_t ticks, int num_lookups)
+    {
+        return juce::String(juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e9 / static_cast<double>(num_lookups), 1);
+    }
+};
+
+static DeviceIndexTest deviceIndexTest;
+
+} // namespace genki
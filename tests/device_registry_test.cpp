@@ -0,0 +1,207 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+#include "allocations.h"
+
+namespace genki {
+
+class DeviceRegistryTest : public juce::UnitTest
+{
+public:
+    DeviceRegistryTest() : juce::UnitTest("DeviceRegistry", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        beginTest("Addresses round-trip through their key");
+        {
+            const auto key = DeviceRegistry::toKey(juce::String("AA:bb:CC:01:02:03"));
+
+            expectEquals(static_cast<juce::int64>(key), static_cast<juce::int64>(0xaabbcc010203));
+            expectEquals(DeviceRegistry::toKey(std::string_view("aa-bb-cc-01-02-03")), key);
+            expectEquals(DeviceRegistry::toKey(DeviceRegistry::toAddressString(key)), key);
+            expectEquals(DeviceRegistry::toAddressString(key), juce::MACAddress(juce::String("aa:bb:cc:01:02:03")).toString());
+        }
+
+        beginTest("Malformed addresses have no key");
+        {
+            expectEquals(DeviceRegistry::toKey(std::string_view("aa:bb:cc:01:02")), uint64_t{0});
+            expectEquals(DeviceRegistry::toKey(std::string_view("aa:bb:cc:01:02:03:04")), uint64_t{0});
+        }
+
+        beginTest("Updates keep the last values and the name once seen");
+        {
+            DeviceRegistry registry;
+
+            expect(!registry.update(1, "first", -40, 100));
+            expect(!registry.update(1, nullptr, -60, 200));
+
+            const auto device = registry.find(1);
+            expect(device.has_value());
+            expectEquals(device->name, juce::String("first"));
+            expectEquals(static_cast<int>(device->rssi), -60);
+            expectEquals(device->lastSeen, 200);
+            expect(!registry.find(2).has_value());
+        }
+
+        beginTest("Promoted devices stay promoted until demoted");
+        {
+            DeviceRegistry registry;
+            registry.update(1, "a", -40, 0);
+
+            expect(registry.promote(1).has_value());
+            expect(!registry.promote(2).has_value());
+            expect(registry.update(1, nullptr, -40, 10));
+
+            registry.demote(1);
+            expect(!registry.update(1, nullptr, -40, 20));
+            expect(registry.update(1, nullptr, -40, 30, true));
+        }
+
+        beginTest("Advertisements are kept until the device is promoted");
+        {
+            DeviceRegistry registry;
+            registry.update(1, "a", -40, 0);
+
+            expect(registry.keepAdvertisement(1, "\x02\x01\x06", 3));
+            expect(!registry.keepAdvertisement(2, "\x02\x01\x06", 3));
+            expect(registry.find(1)->advertisement == juce::MemoryBlock("\x02\x01\x06", 3));
+
+            expect(registry.promote(1).has_value());
+            expect(!registry.keepAdvertisement(1, "\x01", 1));
+            expectEquals(static_cast<int>(registry.find(1)->advertisement.getSize()), 3);
+        }
+
+        beginTest("Expired devices are removed unless promoted, the others stay findable");
+        {
+            DeviceRegistry registry;
+
+            registry.update(1, "a", -40, 0);
+            registry.update(2, "b", -40, 0, true);
+            registry.update(3, "c", -40, 900);
+
+            registry.removeExpired(1000, 500);
+
+            expectEquals(registry.size(), size_t{2});
+            expect(!registry.find(1).has_value());
+            expect(registry.find(2).has_value());
+            expectEquals(registry.find(3)->name, juce::String("c"));
+        }
+
+        beginTest("Devices seen again expire from their last sighting");
+        {
+            DeviceRegistry registry;
+
+            registry.update(1, "a", -40, 0);
+            registry.update(1, nullptr, -40, 800);
+
+            registry.removeExpired(1000, 500);
+            expect(registry.find(1).has_value());
+
+            registry.removeExpired(1400, 500);
+            expect(!registry.find(1).has_value());
+        }
+
+        beginTest("Demoted devices expire again");
+        {
+            DeviceRegistry registry;
+
+            registry.update(1, "a", -40, 0, true);
+            registry.removeExpired(1000, 500);
+            expect(registry.find(1).has_value());
+
+            // Demoting repeatedly doesn't keep it alive or queue it more than once
+            registry.demote(1);
+            registry.demote(1);
+            registry.promote(1);
+            registry.demote(1);
+
+            registry.removeExpired(2000, 500);
+            expect(!registry.find(1).has_value());
+        }
+
+        beginTest("Ingest time and memory vs device nodes");
+        {
+            constexpr int NumDevices         = 10000;
+            constexpr int NumAdvertisements  = 10;
+            constexpr int NumAdvertisedBytes = 31;
+
+            const juce::MemoryBlock record(NumAdvertisedBytes, true);
+
+            // Registry, as used with compact scanning
+            auto bytes_before = numLiveBytes.load();
+            auto start        = juce::Time::getHighResolutionTicks();
+
+            auto registry = std::make_unique<DeviceRegistry>();
+
+            for (int n = 0; n < NumAdvertisements; ++n)
+            {
+                for (int i = 0; i < NumDevices; ++i)
+                {
+                    registry->update(key(i), "Device name", -40, n * 100);
+                    registry->keepAdvertisement(key(i), record.getData(), record.getSize());
+                }
+            }
+
+            const auto registry_time  = juce::Time::getHighResolutionTicks() - start;
+            const auto registry_bytes = numLiveBytes.load() - bytes_before;
+
+            start = juce::Time::getHighResolutionTicks();
+
+            for (int i = 0; i < 1000; ++i)
+                registry->removeExpired(NumAdvertisements * 100, 5000);
+
+            const auto tick_time = juce::Time::getHighResolutionTicks() - start;
+
+            expectEquals(registry->size(), static_cast<size_t>(NumDevices));
+            registry.reset();
+
+            // BLUETOOTH_DEVICE nodes with the index and expiry the adapter keeps on its state
+            bytes_before = numLiveBytes.load();
+            start        = juce::Time::getHighResolutionTicks();
+
+            auto state  = std::make_unique<juce::ValueTree>(ID::BLUETOOTH_ADAPTER);
+            auto index  = std::make_unique<DeviceIndex>(*state);
+            auto expiry = std::make_unique<DeviceExpiry>(*state, 5000);
+
+            for (int n = 0; n < NumAdvertisements; ++n)
+            {
+                for (int i = 0; i < NumDevices; ++i)
+                {
+                    const auto address = DeviceRegistry::toAddressString(key(i));
+
+                    if (auto device = index->find(address); device.isValid())
+                    {
+                        device.setProperty(ID::rssi, -40, nullptr);
+                        device.setProperty(ID::last_seen, n * 100, nullptr);
+                        device.setProperty(ID::advertisement, record, nullptr);
+                    }
+                    else
+                    {
+                        state->appendChild({ID::BLUETOOTH_DEVICE, {{ID::name, "Device name"}, {ID::address, address}, {ID::rssi, -40}, {ID::is_connected, false}, {ID::last_seen, n * 100}, {ID::advertisement, record}}}, nullptr);
+                    }
+                }
+            }
+
+            const auto nodes_time  = juce::Time::getHighResolutionTicks() - start;
+            const auto nodes_bytes = numLiveBytes.load() - bytes_before;
+
+            expectEquals(state->getNumChildren(), NumDevices);
+
+            expiry.reset();
+            index.reset();
+            state.reset();
+
+            const auto ns_per_advertisement = [](int64_t ticks) { return juce::String(juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e9 / (NumDevices * NumAdvertisements), 1); };
+
+            logMessage("Registry: " + ns_per_advertisement(registry_time) + " ns per advertisement, " + juce::String(registry_bytes / NumDevices) + " bytes per device");
+            logMessage("Nodes: " + ns_per_advertisement(nodes_time) + " ns per advertisement, " + juce::String(nodes_bytes / NumDevices) + " bytes per device");
+            logMessage("Registry: " + juce::String(juce::Time::highResolutionTicksToSeconds(tick_time) * 1.0e6, 1) + " ns per removeExpired() tick with nothing due");
+        }
+    }
+
+private:
+    static uint64_t key(int i) { return 0xaabbcc000000 + static_cast<uint64_t>(i); }
+};
+
+static DeviceRegistryTest deviceRegistryTest;
+
+} // namespace genki
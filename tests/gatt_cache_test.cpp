@@ -0,0 +1,164 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+#if JUCE_LINUX
+
+#include "native/linux/gatt_cache.h"
+
+namespace genki {
+
+class GattCacheTest : public juce::UnitTest
+{
+public:
+    GattCacheTest() : juce::UnitTest("GattCache", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        const juce::String address("aa:bb:cc:01:02:03");
+
+        const auto make_database = []
+        {
+            GattDatabase db;
+
+            // Added out of order on purpose, the database keeps them sorted
+            db.addCharacteristic("/org/bluez/hci0/dev_AA/service0010/char0014", juce::Uuid("00002a38-0000-1000-8000-00805f9b34fb"));
+            db.addCharacteristic("/org/bluez/hci0/dev_AA/service0010/char0011", juce::Uuid("00002a37-0000-1000-8000-00805f9b34fb"));
+            db.addService("/org/bluez/hci0/dev_AA/service0010", juce::Uuid("0000180d-0000-1000-8000-00805f9b34fb"));
+            db.addService("/org/bluez/hci0/dev_AA/service0001", juce::Uuid("00001801-0000-1000-8000-00805f9b34fb"));
+
+            db.findCharacteristic("/org/bluez/hci0/dev_AA/service0010/char0011")->notify = true;
+
+            db.databaseHash = juce::MemoryBlock("0123456789abcdef", 16);
+
+            return db;
+        };
+
+        beginTest("Services and characteristics are sorted by path");
+        {
+            const auto db = make_database();
+
+            expectEquals(db.services.size(), size_t{2});
+            expect(db.services[0].path == "/org/bluez/hci0/dev_AA/service0001");
+            expect(db.services[1].uuid == juce::Uuid("0000180d-0000-1000-8000-00805f9b34fb"));
+            expect(db.services[1].characteristics[0].path == "/org/bluez/hci0/dev_AA/service0010/char0011");
+        }
+
+        juce::TemporaryFile directory;
+        GattCache           cache;
+        cache.directory = directory.getFile();
+
+        beginTest("A saved database loads back the same");
+        {
+            const auto db = make_database();
+            expect(cache.save(address, db));
+
+            const auto loaded = cache.load(address);
+
+            expect(loaded.has_value());
+            expectEquals(static_cast<juce::int64>(loaded->checksum()), static_cast<juce::int64>(db.checksum()));
+            expect(loaded->databaseHash == db.databaseHash);
+            expect(loaded->isCompatibleWith(db) && db.isCompatibleWith(*loaded));
+            expect(loaded->services[1].characteristics[0].notify);
+            expect(!loaded->services[1].characteristics[1].notify);
+        }
+
+        beginTest("A file that doesn't match its checksum is a miss");
+        {
+            const auto file = cache.directory.getChildFile("aabbcc010203.gatt");
+            expect(file.existsAsFile());
+
+            juce::MemoryBlock data;
+            file.loadFileAsData(data);
+            // The last digit of the last characteristic's path, followed by its terminator and flags
+            static_cast<char*>(data.getData())[data.getSize() - 3] ^= 0x01;
+            file.replaceWithData(data.getData(), data.getSize());
+
+            expect(!cache.load(address).has_value());
+        }
+
+        beginTest("Removed and unknown devices are a miss");
+        {
+            cache.remove(address);
+
+            expect(!cache.load(address).has_value());
+            expect(!cache.load("00:00:00:00:00:00").has_value());
+        }
+
+        beginTest("A changed layout is not compatible");
+        {
+            const auto db      = make_database();
+            auto       changed = make_database();
+            changed.addCharacteristic("/org/bluez/hci0/dev_AA/service0010/char0017", juce::Uuid("00002a39-0000-1000-8000-00805f9b34fb"));
+
+            expect(!db.isCompatibleWith(changed));
+            expect(db.checksum() != changed.checksum());
+        }
+
+        beginTest("The Database Hash is part of the checksum");
+        {
+            const auto db      = make_database();
+            auto       changed = make_database();
+            changed.databaseHash.reset();
+
+            expect(db.isCompatibleWith(changed));
+            expect(db.checksum() != changed.checksum());
+        }
+
+        beginTest("A loaded database turns into the nodes discovery would publish");
+        {
+            int num_characteristics = 0;
+
+            const auto device = make_database().toValueTree([&](const auto&, const auto&) { ++num_characteristics; });
+
+            expectEquals(device.getNumChildren(), 2);
+            expectEquals(num_characteristics, 2);
+
+            const auto charact = device.getChild(1).getChild(0);
+            expect(charact.hasType(ID::CHARACTERISTIC));
+            expectEquals(charact.getProperty(ID::uuid).toString(), juce::String("00002a37-0000-1000-8000-00805f9b34fb"));
+            expectEquals(charact.getProperty(ID::dbus_object_path).toString(), juce::String("/org/bluez/hci0/dev_AA/service0010/char0011"));
+        }
+
+        beginTest("Restore time from file to nodes");
+        {
+            constexpr int NumServices        = 8;
+            constexpr int NumCharacteristics = 8;
+            constexpr int NumRestores        = 1000;
+
+            GattDatabase db;
+
+            for (int s = 0; s < NumServices; ++s)
+            {
+                const auto service_path = juce::String::formatted("/org/bluez/hci0/dev_AA/service%04x", 0x10 * (s + 1)).toStdString();
+                db.addService(service_path, juce::Uuid());
+
+                for (int c = 0; c < NumCharacteristics; ++c)
+                    db.addCharacteristic(service_path + juce::String::formatted("/char%04x", 0x10 * (s + 1) + c + 1).toStdString(), juce::Uuid());
+            }
+
+            expect(cache.save(address, db));
+
+            int num_characteristics = 0;
+
+            const auto start = juce::Time::getHighResolutionTicks();
+
+            for (int i = 0; i < NumRestores; ++i)
+                if (const auto loaded = cache.load(address))
+                    (void) loaded->toValueTree([&](const auto&, const auto&) { ++num_characteristics; });
+
+            const auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+            expectEquals(num_characteristics, NumRestores * NumServices * NumCharacteristics);
+
+            logMessage(juce::String(seconds * 1.0e6 / NumRestores, 1) + " us per restore of " + juce::String(NumServices) + " services with "
+                       + juce::String(NumCharacteristics) + " characteristics each, file read to nodes");
+        }
+
+        directory.getFile().deleteRecursively();
+    }
+};
+
+static GattCacheTest gattCacheTest;
+
+} // namespace genki
+
+#endif
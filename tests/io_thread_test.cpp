@@ -0,0 +1,132 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+#if JUCE_LINUX
+
+#include "native/linux/io_thread.h"
+
+namespace genki {
+
+// Typed calls reach the backend as commands on the I/O thread, or as message nodes appended to the state. Both are
+// timed for a command the size of a typical typed call (address, UUID and a flag).
+class IoThreadTest : public juce::UnitTest
+{
+public:
+    IoThreadTest() : juce::UnitTest("IoThread", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        constexpr int NumCommands = 100000;
+
+        const juce::String address("aa:bb:cc:dd:ee:ff");
+        const juce::Uuid   uuid("00002a37-0000-1000-8000-00805f9b34fb");
+
+        beginTest("Commands run on the thread in submission order");
+        {
+            IoThread            thread;
+            std::vector<int>    order;
+            juce::WaitableEvent done;
+
+            for (int i = 0; i < 100; ++i)
+                thread.invoke([&order, i] { order.push_back(i); });
+
+            thread.invoke([&done] { done.signal(); });
+
+            expect(done.wait(1000));
+            thread.stop([] {});
+
+            expectEquals(static_cast<int>(order.size()), 100);
+            expect(std::is_sorted(order.begin(), order.end()));
+        }
+
+        beginTest("Typed commands vs std::function vs message nodes");
+        {
+            int64_t typed_time    = 0;
+            int64_t function_time = 0;
+
+            {
+                IoThread thread;
+                typed_time = timeCommands(thread, NumCommands, [&](auto& num_run)
+                                          { thread.invoke([&num_run, address, uuid, acquire = true] { handleCommand(num_run, address, uuid, acquire); }); });
+                thread.stop([] {});
+            }
+
+            {
+                IoThread thread;
+                function_time = timeCommands(thread, NumCommands, [&](auto& num_run)
+                                             { thread.invoke(std::function<void()>([&num_run, address, uuid, acquire = true] { handleCommand(num_run, address, uuid, acquire); })); });
+                thread.stop([] {});
+            }
+
+            // The handler of the message path, listening on the state like the backend does
+            struct Handler : juce::ValueTree::Listener
+            {
+                void valueTreeChildAdded(juce::ValueTree&, juce::ValueTree& child) override
+                {
+                    if (child.hasType(ID::ENABLE_NOTIFICATIONS) && child.getProperty(ID::uuid).toString().isNotEmpty())
+                        ++numHandled;
+                }
+
+                int numHandled = 0;
+            };
+
+            juce::ValueTree state(ID::BLUETOOTH_ADAPTER);
+            juce::ValueTree device(ID::BLUETOOTH_DEVICE, {{ID::address, address}});
+            state.appendChild(device, nullptr);
+
+            Handler handler;
+            state.addListener(&handler);
+
+            const auto start = juce::Time::getHighResolutionTicks();
+
+            for (int i = 0; i < NumCommands; ++i)
+                genki::message(device, {ID::ENABLE_NOTIFICATIONS, {{ID::uuid, uuid.toDashedString()}}});
+
+            const auto message_time = juce::Time::getHighResolutionTicks() - start;
+
+            state.removeListener(&handler);
+
+            expectEquals(handler.numHandled, NumCommands);
+
+            const auto ns_per_command = [](int64_t ticks) { return juce::String(juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e9 / NumCommands, 1); };
+
+            logMessage(ns_per_command(typed_time) + " ns per typed command to the I/O thread");
+            logMessage(ns_per_command(function_time) + " ns per std::function command to the I/O thread");
+            logMessage(ns_per_command(message_time) + " ns per message node on the calling thread");
+        }
+    }
+
+private:
+    static void handleCommand(std::atomic<int>& num_run, const juce::String& address, const juce::Uuid& uuid, bool acquire)
+    {
+        if (address.isNotEmpty() && !uuid.isNull() && acquire)
+            ++num_run;
+    }
+
+    // Submits numCommands with submit(num_run) and waits until the thread has run them all
+    template<typename Submit>
+    int64_t timeCommands(IoThread& thread, int numCommands, Submit&& submit)
+    {
+        std::atomic<int>    num_run{0};
+        juce::WaitableEvent done;
+
+        const auto start = juce::Time::getHighResolutionTicks();
+
+        for (int i = 0; i < numCommands; ++i)
+            submit(num_run);
+
+        thread.invoke([&done] { done.signal(); });
+        expect(done.wait(10000));
+
+        const auto elapsed = juce::Time::getHighResolutionTicks() - start;
+
+        expectEquals(num_run.load(), numCommands);
+
+        return elapsed;
+    }
+};
+
+static IoThreadTest ioThreadTest;
+
+} // namespace genki
+
+#endif
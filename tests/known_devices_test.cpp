@@ -0,0 +1,132 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+namespace genki {
+
+class KnownDevicesTest : public juce::UnitTest
+{
+public:
+    KnownDevicesTest() : juce::UnitTest("KnownDevices", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        juce::TemporaryFile file;
+
+        beginTest("Remembered devices are found by any spelling of their address");
+        {
+            KnownDevices known;
+            known.setFile(file.getFile());
+
+            known.remember({"AA:BB:CC:01:02:03", "Sensor", "random", {"0000180d-0000-1000-8000-00805f9b34fb"}, 1000});
+            expect(known.flush());
+
+            const auto device = known.find("aa-bb-cc-01-02-03");
+            expect(device.has_value());
+            expectEquals(device->name, juce::String("Sensor"));
+            expectEquals(device->services.size(), 1);
+            expect(!known.find("aa:bb:cc:01:02:04").has_value());
+        }
+
+        beginTest("What BlueZ didn't report again is kept");
+        {
+            KnownDevices known;
+            known.setFile(file.getFile());
+
+            known.remember({"aa:bb:cc:01:02:03", {}, {}, {}, 2000});
+            expect(known.flush());
+
+            const auto device = known.find("aa:bb:cc:01:02:03");
+            expectEquals(device->name, juce::String("Sensor"));
+            expectEquals(device->addressType, juce::String("random"));
+            expectEquals(device->lastConnected, juce::int64{2000});
+        }
+
+        beginTest("Remembered devices are only written when flushed");
+        {
+            KnownDevices known;
+            known.setFile(file.getFile());
+
+            const auto last_modified = file.getFile().getLastModificationTime();
+            known.remember({"aa:bb:cc:01:02:04", "Other", "public", {}, 3000});
+
+            KnownDevices before_flush;
+            before_flush.setFile(file.getFile());
+            expect(!before_flush.find("aa:bb:cc:01:02:04").has_value());
+            expect(file.getFile().getLastModificationTime() == last_modified);
+
+            expect(known.flush());
+            known.forget("aa:bb:cc:01:02:04");
+        }
+
+        beginTest("Devices are read back from the file");
+        {
+            KnownDevices known;
+            known.setFile(file.getFile());
+
+            int num_devices = 0;
+            known.forEach([&](const auto&) { ++num_devices; });
+
+            expectEquals(num_devices, 1);
+            expect(known.find("aa:bb:cc:01:02:03").has_value());
+        }
+
+        beginTest("Forgotten devices are gone from the file too");
+        {
+            KnownDevices known;
+            known.setFile(file.getFile());
+
+            expect(known.forget("aa:bb:cc:01:02:03"));
+            expect(!known.find("aa:bb:cc:01:02:03").has_value());
+
+            KnownDevices reloaded;
+            reloaded.setFile(file.getFile());
+            expect(!reloaded.find("aa:bb:cc:01:02:03").has_value());
+        }
+
+        beginTest("Without a file devices are only kept in memory");
+        {
+            KnownDevices known;
+
+            known.remember({"aa:bb:cc:01:02:03", "Sensor", "public", {}, 0});
+            expect(known.flush());
+            expect(known.find("aa:bb:cc:01:02:03").has_value());
+        }
+
+        beginTest("Load time");
+        {
+            constexpr int NumDevices = 1000;
+
+            juce::TemporaryFile large_file;
+
+            {
+                KnownDevices known;
+                known.setFile(large_file.getFile());
+
+                for (int i = 0; i < NumDevices; ++i)
+                {
+                    const auto address = juce::String::formatted("aa:bb:cc:%02x:%02x:%02x", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+                    known.remember({address, "Sensor " + juce::String(i), "random", {"0000180d-0000-1000-8000-00805f9b34fb", "0000180f-0000-1000-8000-00805f9b34fb", "0000180a-0000-1000-8000-00805f9b34fb"}, i});
+                }
+
+                expect(known.flush());
+            }
+
+            // setKnownDevicesFile() is called on the message thread before the adapter can connect
+            KnownDevices known;
+
+            const auto start = juce::Time::getHighResolutionTicks();
+            known.setFile(large_file.getFile());
+            const auto load_time = juce::Time::getHighResolutionTicks() - start;
+
+            int num_devices = 0;
+            known.forEach([&](const auto&) { ++num_devices; });
+            expectEquals(num_devices, NumDevices);
+
+            logMessage(juce::String(juce::Time::highResolutionTicksToSeconds(load_time) * 1.0e3, 1) + " ms to load " + juce::String(NumDevices) + " devices, "
+                       + juce::String(large_file.getFile().getSize()) + " bytes");
+        }
+    }
+};
+
+static KnownDevicesTest knownDevicesTest;
+
+} // namespace genki
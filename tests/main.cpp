@@ -0,0 +1,16 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+int main()
+{
+    juce::ScopedJuceInitialiser_GUI juce_init;
+
+    juce::UnitTestRunner runner;
+    runner.setAssertOnFailure(false);
+    runner.runTestsInCategory("juce_bluetooth");
+
+    for (int i = 0; i < runner.getNumResults(); ++i)
+        if (runner.getResult(i)->failures > 0)
+            return 1;
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+#include "allocations.h"
+
+namespace genki {
+
+class NotificationRingTest : public juce::UnitTest
+{
+public:
+    NotificationRingTest() : juce::UnitTest("NotificationRing", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        beginTest("Capacity is rounded up to a power of two");
+        {
+            NotificationRing ring(5, 4);
+            expectEquals(ring.getCapacity(), size_t{8});
+            expectEquals(ring.getMaxValueLength(), size_t{4});
+        }
+
+        beginTest("Records come out in arrival order across the wraparound");
+        {
+            NotificationRing ring(4, 1);
+            std::vector<int> values;
+
+            const auto consume_all = [&]
+            { ring.consume([&](const auto& n) { values.push_back(static_cast<int>(n.value[0])); }); };
+
+            for (int round = 0; round < 3; ++round)
+            {
+                for (int i = 0; i < 3; ++i)
+                    expect(ring.push(bytes({static_cast<uint8_t>(round * 3 + i)})));
+
+                consume_all();
+            }
+
+            expect(values == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8});
+            expectEquals(ring.getNumReady(), size_t{0});
+        }
+
+        beginTest("Consume honours maxCount and keeps the rest");
+        {
+            NotificationRing ring(4, 1);
+
+            for (uint8_t i = 0; i < 3; ++i)
+                ring.push(bytes({i}), i);
+
+            int64_t last_timestamp = -1;
+            expectEquals(ring.consume([&](const auto& n) { last_timestamp = n.timestamp; }, 2), size_t{2});
+            expectEquals(last_timestamp, int64_t{1});
+            expectEquals(ring.getNumReady(), size_t{1});
+        }
+
+        beginTest("Counters track pushes, overflows and truncations");
+        {
+            NotificationRing ring(2, 2);
+
+            expect(ring.push(bytes({1, 2, 3})));
+            expect(ring.push(bytes({4})));
+            expect(!ring.push(bytes({5})));
+
+            expectEquals(ring.getNumPushed(), uint64_t{2});
+            expectEquals(ring.getNumOverflows(), uint64_t{1});
+            expectEquals(ring.getNumTruncated(), uint64_t{1});
+
+            std::vector<size_t> lengths;
+            ring.consume([&](const auto& n) { lengths.push_back(n.value.size()); });
+            expect(lengths == std::vector<size_t>{2, 1});
+        }
+
+        beginTest("Discard drops what doesn't fit, FallBackToCallback leaves it to the callback");
+        {
+            NotificationRing discard(2, 1, NotificationRing::OverflowPolicy::Discard);
+            NotificationRing fallback(2, 1, NotificationRing::OverflowPolicy::FallBackToCallback);
+
+            for (auto* ring: {&discard, &fallback})
+            {
+                expect(ring->offer(bytes({1})));
+                expect(ring->offer(bytes({2})));
+            }
+
+            expect(discard.offer(bytes({3})));
+            expect(!fallback.offer(bytes({3})));
+
+            expectEquals(discard.getNumOverflows(), uint64_t{1});
+            expectEquals(fallback.getNumOverflows(), uint64_t{1});
+        }
+
+        beginTest("Consuming doesn't allocate");
+        {
+            constexpr size_t NumRecords = 1 << 20;
+
+            NotificationRing ring(256, 20);
+            const auto       value = bytes({0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08});
+
+            size_t  num_consumed = 0;
+            int64_t checksum     = 0;
+            int64_t consume_time = 0;
+
+            const auto allocations_before = numAllocations.load();
+
+            while (num_consumed < NumRecords)
+            {
+                while (ring.push(value, static_cast<int64_t>(num_consumed)))
+                    ;
+
+                const auto start = juce::Time::getHighResolutionTicks();
+                num_consumed += ring.consume([&](const auto& n) { checksum += n.timestamp + static_cast<int64_t>(n.value[0]); });
+                consume_time += juce::Time::getHighResolutionTicks() - start;
+            }
+
+            expectEquals(static_cast<int>(numAllocations.load() - allocations_before), 0);
+            expect(checksum > 0);
+
+            logMessage(juce::String(juce::Time::highResolutionTicksToSeconds(consume_time) * 1.0e9 / static_cast<double>(num_consumed), 1) + " ns per consumed record");
+        }
+    }
+
+private:
+    static std::vector<gsl::byte> bytes(std::initializer_list<uint8_t> values)
+    {
+        std::vector<gsl::byte> v;
+
+        for (const auto b: values)
+            v.push_back(static_cast<gsl::byte>(b));
+
+        return v;
+    }
+};
+
+static NotificationRingTest notificationRingTest;
+
+} // namespace genki
@@ -0,0 +1,214 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+#if JUCE_LINUX
+
+#include "native/linux/notify_channel.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace genki {
+
+// The provider plays BlueZ: AcquireNotify hands out one end of a SOCK_SEQPACKET pair and keeps the other
+class NotifyChannelTest : public juce::UnitTest
+{
+public:
+    NotifyChannelTest() : juce::UnitTest("NotifyChannel", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        using State = NotifyChannel::State;
+
+        beginTest("Acquire, hang-up, re-acquire and fall back to StartNotify");
+        {
+            FakeProvider  provider;
+            NotifyChannel channel(provider, "/org/bluez/hci0/dev_00_11_22_33_44_55/service0010/char0011");
+
+            channel.enable(true);
+
+            expect(channel.getState() == State::Socket);
+            expectEquals(provider.numAcquired, 1);
+            expectEquals(provider.numEnabled, 1);
+            expectEquals(static_cast<int>(channel.getMtu()), 23);
+
+            provider.send({0x01, 0x02});
+            expect(pump([&] { return provider.received.size() == 1; }));
+            expect(provider.received[0] == std::vector<uint8_t>{0x01, 0x02});
+
+            // Another client stopped notifications, the device is still connected
+            provider.hangUp();
+            expect(pump([&] { return provider.numAcquired == 2; }));
+            expect(channel.getState() == State::Socket);
+            expectEquals(provider.numEnabled, 2);
+
+            provider.send({0x03});
+            expect(pump([&] { return provider.received.size() == 2; }));
+            expect(provider.received[1] == std::vector<uint8_t>{0x03});
+
+            // The next AcquireNotify is refused, notifications continue as PropertiesChanged signals
+            provider.acquireFails = true;
+            provider.hangUp();
+            expect(pump([&] { return channel.getState() == State::Signals; }));
+            expectEquals(provider.numAcquired, 2);
+            expectEquals(provider.numStarted, 1);
+            expectEquals(provider.numEnabled, 3);
+        }
+
+        beginTest("Requests made while enabled are answered right away");
+        {
+            FakeProvider  provider;
+            NotifyChannel channel(provider, "/char");
+
+            channel.enable(false);
+            channel.enable(true);
+
+            expect(channel.getState() == State::Signals);
+            expectEquals(provider.numStarted, 1);
+            expectEquals(provider.numAcquired, 0);
+            expectEquals(provider.numEnabled, 2);
+        }
+
+        beginTest("Requests made while a call is in flight wait for it");
+        {
+            FakeProvider  provider;
+            NotifyChannel channel(provider, "/char");
+
+            provider.answer = false;
+            channel.enable(true);
+            channel.enable(true);
+
+            expect(channel.getState() == State::Acquiring);
+            expectEquals(provider.numEnabled, 0);
+
+            channel.acquireFailed();
+            expect(channel.getState() == State::StartingNotify);
+
+            channel.startFailed();
+            expect(channel.getState() == State::Off);
+            expectEquals(provider.numEnabled, 0);
+        }
+
+        beginTest("A socket acquired too late is closed");
+        {
+            FakeProvider  provider;
+            NotifyChannel channel(provider, "/char");
+
+            int fds[2];
+            socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds);
+
+            channel.acquired(fds[0], 23);
+            expect(channel.getState() == State::Off);
+
+            // Note: Our end was closed, so the peer's send fails
+            const uint8_t byte = 0;
+            expect(::send(fds[1], &byte, 1, MSG_NOSIGNAL) < 0);
+            close(fds[1]);
+        }
+
+        beginTest("A hang-up after the device disconnected turns the channel off");
+        {
+            FakeProvider  provider;
+            NotifyChannel channel(provider, "/char");
+
+            channel.enable(true);
+
+            provider.connected = false;
+            provider.hangUp();
+            expect(pump([&] { return channel.getState() == State::Off; }));
+            expectEquals(provider.numAcquired, 1);
+        }
+    }
+
+private:
+    struct FakeProvider : NotifyChannel::Provider
+    {
+        ~FakeProvider() override { hangUp(); }
+
+        void acquireNotify(NotifyChannel& channel) override
+        {
+            if (!answer)
+                return;
+
+            if (acquireFails)
+            {
+                channel.acquireFailed();
+                return;
+            }
+
+            int fds[2];
+            socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds);
+
+            peer = fds[1];
+            ++numAcquired;
+
+            channel.acquired(fds[0], 23);
+        }
+
+        void startNotify(NotifyChannel& channel) override
+        {
+            if (!answer)
+                return;
+
+            ++numStarted;
+            channel.started();
+        }
+
+        void notificationReceived(NotifyChannel&, gsl::span<const gsl::byte> data) override
+        {
+            const auto* bytes = reinterpret_cast<const uint8_t*>(data.data());
+            received.emplace_back(bytes, bytes + data.size());
+        }
+
+        void notificationsEnabled(NotifyChannel&) override { ++numEnabled; }
+
+        bool shouldReacquire(NotifyChannel&) override { return connected; }
+
+        void send(std::initializer_list<uint8_t> bytes) const
+        {
+            const std::vector<uint8_t> packet(bytes);
+            ::send(peer, packet.data(), packet.size(), MSG_NOSIGNAL);
+        }
+
+        void hangUp()
+        {
+            if (peer >= 0)
+                close(peer);
+
+            peer = -1;
+        }
+
+        bool answer       = true;
+        bool acquireFails = false;
+        bool connected    = true;
+
+        int peer        = -1;
+        int numAcquired = 0;
+        int numStarted  = 0;
+        int numEnabled  = 0;
+
+        std::vector<std::vector<uint8_t>> received;
+    };
+
+    // Dispatches the socket watches until done() or the deadline
+    template<typename Done>
+    static bool pump(Done&& done)
+    {
+        const auto deadline = juce::Time::getMillisecondCounter() + 1000;
+
+        while (!done())
+        {
+            if (juce::Time::getMillisecondCounter() > deadline)
+                return false;
+
+            g_main_context_iteration(nullptr, FALSE);
+        }
+
+        return true;
+    }
+};
+
+static NotifyChannelTest notifyChannelTest;
+
+} // namespace genki
+
+#endif
@@ -0,0 +1,99 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+#if JUCE_LINUX
+
+#include "native/linux/notify_socket.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace genki {
+
+// AcquireNotify hands out one end of a SOCK_SEQPACKET pair, the test plays BlueZ on the other end
+class NotifySocketTest : public juce::UnitTest
+{
+public:
+    NotifySocketTest() : juce::UnitTest("NotifySocket", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        using bluez_utils::NotifySocketStatus;
+
+        beginTest("Short packets are delivered one at a time with their own length");
+        {
+            Socket s;
+            std::vector<gsl::byte> buffer(20);
+            std::vector<size_t>    lengths;
+
+            s.send({0x01});
+            s.send({0x02, 0x03, 0x04});
+
+            const auto deliver = [&](gsl::span<const gsl::byte> data) { lengths.push_back(data.size()); };
+
+            expect(bluez_utils::read_notification(s.fds[0], buffer, deliver) == NotifySocketStatus::Delivered);
+            expect(bluez_utils::read_notification(s.fds[0], buffer, deliver) == NotifySocketStatus::Delivered);
+            expect(lengths == std::vector<size_t>{1, 3});
+            expect(buffer[1] == gsl::byte{0x03});
+        }
+
+        beginTest("An empty socket would block and delivers nothing");
+        {
+            Socket s;
+            std::vector<gsl::byte> buffer(20);
+            int                    num_delivered = 0;
+
+            expect(bluez_utils::read_notification(s.fds[0], buffer, [&](auto) { ++num_delivered; }) == NotifySocketStatus::WouldBlock);
+            expectEquals(num_delivered, 0);
+        }
+
+        beginTest("Hanging up closes the channel once the queued notifications are read");
+        {
+            Socket s;
+            std::vector<gsl::byte> buffer(20);
+            int                    num_delivered = 0;
+
+            s.send({0x2a});
+            s.hangUp();
+
+            const auto deliver = [&](auto) { ++num_delivered; };
+
+            expect(bluez_utils::read_notification(s.fds[0], buffer, deliver) == NotifySocketStatus::Delivered);
+            expect(bluez_utils::read_notification(s.fds[0], buffer, deliver) == NotifySocketStatus::Closed);
+            expectEquals(num_delivered, 1);
+        }
+
+    }
+
+private:
+    struct Socket
+    {
+        Socket() { socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds); }
+
+        ~Socket()
+        {
+            for (auto fd: fds)
+                if (fd >= 0)
+                    close(fd);
+        }
+
+        void send(std::initializer_list<uint8_t> bytes) const
+        {
+            const std::vector<uint8_t> packet(bytes);
+            ::send(fds[1], packet.data(), packet.size(), MSG_NOSIGNAL);
+        }
+
+        void hangUp()
+        {
+            close(fds[1]);
+            fds[1] = -1;
+        }
+
+        int fds[2] = {-1, -1};
+    };
+};
+
+static NotifySocketTest notifySocketTest;
+
+} // namespace genki
+
+#endif
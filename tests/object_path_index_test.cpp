@@ -0,0 +1,124 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+#if JUCE_LINUX
+
+#include "native/linux/object_paths.h"
+
+namespace genki {
+
+class ObjectPathIndexTest : public juce::UnitTest
+{
+public:
+    ObjectPathIndexTest() : juce::UnitTest("ObjectPathIndex", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        const std::string device  = "/org/bluez/hci0/dev_AA_BB_CC_DD_EE_FF";
+        const std::string service = device + "/service0010";
+        const std::string charact = service + "/char0011";
+
+        beginTest("Paths are listed under their parent once");
+        {
+            ObjectPathIndex index;
+
+            index.add(device);
+            index.add(service);
+            index.add(charact);
+            index.add(charact);
+
+            expect(index.getChildren(device) == std::vector<std::string>{service});
+            expect(index.getChildren(service) == std::vector<std::string>{charact});
+            expect(index.getChildren(charact).empty());
+        }
+
+        beginTest("Removing a path removes its subtree");
+        {
+            ObjectPathIndex index;
+
+            index.add(device);
+            index.add(service);
+            index.add(charact);
+            index.add(charact + "/desc0013");
+
+            index.remove(service);
+
+            expect(index.getChildren(device).empty());
+            expect(index.getChildren(service).empty());
+            expect(index.getChildren(charact).empty());
+        }
+
+        beginTest("Descriptor walk over the index vs scanning every object path");
+        {
+            constexpr int NumDevices         = 500;
+            constexpr int NumServices        = 8;
+            constexpr int NumCharacteristics = 8;
+            constexpr int NumDescriptors     = 2;
+            constexpr int NumWalks           = 100;
+
+            // One connected device with its GATT database among scanned devices, like GetManagedObjects returns them
+            std::vector<std::string> objects{"/org/bluez/hci0"};
+
+            for (int d = 0; d < NumDevices; ++d)
+                objects.push_back(juce::String::formatted("/org/bluez/hci0/dev_AA_BB_CC_DD_%02X_%02X", (d >> 8) & 0xff, d & 0xff).toStdString());
+
+            const auto               connected = objects.back();
+            std::vector<std::string> characteristics;
+
+            for (int s = 0; s < NumServices; ++s)
+            {
+                const auto service_path = connected + juce::String::formatted("/service%04x", 0x10 * (s + 1)).toStdString();
+                objects.push_back(service_path);
+
+                for (int c = 0; c < NumCharacteristics; ++c)
+                {
+                    const auto charact_path = service_path + juce::String::formatted("/char%04x", 0x10 * (s + 1) + 3 * c + 1).toStdString();
+                    objects.push_back(charact_path);
+                    characteristics.push_back(charact_path);
+
+                    for (int n = 0; n < NumDescriptors; ++n)
+                        objects.push_back(charact_path + juce::String::formatted("/desc%04x", 0x10 * (s + 1) + 3 * c + 2 + n).toStdString());
+                }
+            }
+
+            ObjectPathIndex index;
+
+            for (const auto& path: objects)
+                index.add(path);
+
+            int num_found = 0;
+
+            auto start = juce::Time::getHighResolutionTicks();
+
+            for (int i = 0; i < NumWalks; ++i)
+                for (const auto& s: index.getChildren(connected))
+                    for (const auto& c: index.getChildren(s))
+                        num_found += static_cast<int>(index.getChildren(c).size());
+
+            const auto index_time = juce::Time::getHighResolutionTicks() - start;
+
+            start = juce::Time::getHighResolutionTicks();
+
+            // Every characteristic looks through all objects for paths below it
+            for (int i = 0; i < NumWalks; ++i)
+                for (const auto& c: characteristics)
+                    for (const auto& path: objects)
+                        if (path.size() > c.size() && path.compare(0, c.size(), c) == 0 && path[c.size()] == '/')
+                            ++num_found;
+
+            const auto scan_time = juce::Time::getHighResolutionTicks() - start;
+
+            expectEquals(num_found, 2 * NumWalks * NumServices * NumCharacteristics * NumDescriptors);
+
+            const auto us_per_walk = [](int64_t ticks) { return juce::String(juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e6 / NumWalks, 1); };
+
+            logMessage(us_per_walk(index_time) + " us per descriptor walk over the index, " + juce::String(static_cast<int>(objects.size())) + " objects");
+            logMessage(us_per_walk(scan_time) + " us per descriptor walk scanning all object paths");
+        }
+    }
+};
+
+static ObjectPathIndexTest objectPathIndexTest;
+
+} // namespace genki
+
+#endif
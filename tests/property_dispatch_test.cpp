@@ -0,0 +1,170 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+#if JUCE_LINUX
+
+#include "native/linux/property_dispatch.h"
+
+#include <cstring>
+
+namespace genki {
+
+// PropertiesChanged signals are dispatched through interned quarks. The string-compare chain they replaced is kept
+// here, with the same handlers, to time one against the other.
+class PropertyDispatchTest : public juce::UnitTest
+{
+public:
+    PropertyDispatchTest() : juce::UnitTest("PropertyDispatch", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        using Interface = PropertyDispatchTable::Interface;
+        using Property  = PropertyDispatchTable::Property;
+
+        const PropertyDispatchTable table;
+
+        beginTest("Names map to their interface and property");
+        {
+            expect(table.getInterface("org.bluez.Device1") == Interface::Device);
+            expect(table.getInterface("org.bluez.GattCharacteristic1") == Interface::Characteristic);
+            expect(table.getInterface("org.bluez.Battery1") == Interface::Unknown);
+
+            expect(table.getProperty(Interface::Device, "RSSI") == Property::Rssi);
+            expect(table.getProperty(Interface::Device, "TxPower") == Property::Advertisement);
+            expect(table.getProperty(Interface::Characteristic, "Value") == Property::Value);
+
+            // Known names on the wrong interface, and names never interned
+            expect(table.getProperty(Interface::Characteristic, "RSSI") == Property::Unknown);
+            expect(table.getProperty(Interface::Device, "Trusted") == Property::Unknown);
+        }
+
+        beginTest("Only handled properties are passed on");
+        {
+            GVariant* changed = makeChanged({{"RSSI", g_variant_new_int16(-40)}, {"Trusted", g_variant_new_boolean(TRUE)}});
+
+            std::vector<Property> seen;
+            table.forEachChanged(Interface::Device, changed, [&](Property p, GVariant* value)
+                                 {
+                                     seen.push_back(p);
+                                     expectEquals(static_cast<int>(g_variant_get_int16(value)), -40);
+                                 });
+
+            expect(seen == std::vector<Property>{Property::Rssi});
+
+            g_variant_unref(changed);
+        }
+
+        beginTest("Quark table vs string-compare chain");
+        {
+            constexpr int NumSignals = 100000;
+
+            const guint8 manufacturer_data[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+            const guint8 value[20]           = {};
+
+            GVariantBuilder manufacturer;
+            g_variant_builder_init(&manufacturer, G_VARIANT_TYPE("a{qv}"));
+            g_variant_builder_add(&manufacturer, "{qv}", guint16{0x004c}, g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, manufacturer_data, sizeof(manufacturer_data), 1));
+
+            // What a scan and a notifying characteristic send most
+            const std::vector<std::pair<const char*, GVariant*>> signals{
+                    {"org.bluez.Device1", makeChanged({{"RSSI", g_variant_new_int16(-40)}, {"ManufacturerData", g_variant_builder_end(&manufacturer)}})},
+                    {"org.bluez.Device1", makeChanged({{"RSSI", g_variant_new_int16(-52)}, {"TxPower", g_variant_new_int16(4)}})},
+                    {"org.bluez.Device1", makeChanged({{"Trusted", g_variant_new_boolean(TRUE)}, {"Blocked", g_variant_new_boolean(FALSE)}})},
+                    {"org.bluez.GattCharacteristic1", makeChanged({{"Value", g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, value, sizeof(value), 1)}})},
+            };
+
+            int num_table = 0;
+
+            auto start = juce::Time::getHighResolutionTicks();
+
+            for (int i = 0; i < NumSignals; ++i)
+            {
+                const auto& [interface_name, changed] = signals[static_cast<size_t>(i) % signals.size()];
+
+                if (const auto interface = table.getInterface(interface_name); interface != Interface::Unknown)
+                    table.forEachChanged(interface, changed, [&](Property, GVariant*) { ++num_table; });
+            }
+
+            const auto table_time = juce::Time::getHighResolutionTicks() - start;
+
+            int num_chain = 0;
+
+            start = juce::Time::getHighResolutionTicks();
+
+            for (int i = 0; i < NumSignals; ++i)
+            {
+                const auto& [interface_name, changed] = signals[static_cast<size_t>(i) % signals.size()];
+                num_chain += dispatchByName(interface_name, changed);
+            }
+
+            const auto chain_time = juce::Time::getHighResolutionTicks() - start;
+
+            for (const auto& signal: signals)
+                g_variant_unref(signal.second);
+
+            expectEquals(num_table, num_chain);
+
+            const auto ns_per_signal = [](int64_t ticks) { return juce::String(juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e9 / NumSignals, 1); };
+
+            logMessage(ns_per_signal(table_time) + " ns per signal through the quark table");
+            logMessage(ns_per_signal(chain_time) + " ns per signal through the string-compare chain");
+        }
+    }
+
+private:
+    static GVariant* makeChanged(std::initializer_list<std::pair<const char*, GVariant*>> properties)
+    {
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+        for (const auto& [name, value]: properties)
+            g_variant_builder_add(&builder, "{sv}", name, value);
+
+        return g_variant_ref_sink(g_variant_builder_end(&builder));
+    }
+
+    // The dispatch the quark table replaced: the interface name as a juce::String, every value unpacked, then compared
+    // name by name. Returns the number of properties that had a handler.
+    static int dispatchByName(const char* interface, GVariant* changed_properties)
+    {
+        const juce::String interface_name(interface);
+
+        const auto is_device         = interface_name == "org.bluez.Device1";
+        const auto is_characteristic = interface_name == "org.bluez.GattCharacteristic1";
+
+        if (!is_device && !is_characteristic)
+            return 0;
+
+        int num_handled = 0;
+
+        GVariantIter* iter = nullptr;
+        g_variant_get(changed_properties, "a{sv}", &iter);
+
+        const gchar* key   = nullptr;
+        GVariant*    value = nullptr;
+
+        while (g_variant_iter_loop(iter, "{&sv}", &key, &value))
+        {
+            if (is_device)
+            {
+                if (strcmp(key, "Connected") == 0 || strcmp(key, "ServicesResolved") == 0 || strcmp(key, "RSSI") == 0)
+                    ++num_handled;
+                else if (strcmp(key, "ManufacturerData") == 0 || strcmp(key, "ServiceData") == 0 || strcmp(key, "TxPower") == 0 || strcmp(key, "UUIDs") == 0)
+                    ++num_handled;
+            }
+            else if (strcmp(key, "WriteAcquired") == 0 || strcmp(key, "MTU") == 0 || strcmp(key, "Value") == 0)
+            {
+                ++num_handled;
+            }
+        }
+
+        g_variant_iter_free(iter);
+
+        return num_handled;
+    }
+};
+
+static PropertyDispatchTest propertyDispatchTest;
+
+} // namespace genki
+
+#endif
@@ -0,0 +1,88 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+namespace genki {
+
+// The Linux backend publishes every device BlueZ knows at startup as one batch of nodes appended on the message thread.
+// This times that batch against the listeners a BleAdapter keeps on its state.
+class WarmStartTest : public juce::UnitTest
+{
+public:
+    WarmStartTest() : juce::UnitTest("WarmStart", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        beginTest("Publishing the imported devices");
+        {
+            constexpr int NumDevices   = 1000;
+            constexpr int NumConnected = 10;
+
+            juce::ValueTree       state(ID::BLUETOOTH_ADAPTER);
+            DeviceExpiry          expiry(state, 10000);
+            DeviceIndex           index(state);
+            AdvertisementThrottle advertisements(state);
+
+            auto start = juce::Time::getHighResolutionTicks();
+
+            std::vector<juce::ValueTree> devices;
+
+            for (int i = 0; i < NumDevices; ++i)
+                devices.push_back(makeDevice(i, i < NumConnected));
+
+            const auto build_time = juce::Time::getHighResolutionTicks() - start;
+
+            start = juce::Time::getHighResolutionTicks();
+
+            for (const auto& device: devices)
+                state.appendChild(device, nullptr);
+
+            const auto publish_time = juce::Time::getHighResolutionTicks() - start;
+
+            expectEquals(state.getNumChildren(), NumDevices);
+            expect(index.find(address(NumDevices - 1)).isValid());
+
+            const auto ms = [](int64_t ticks) { return juce::String(juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e3, 2); };
+
+            logMessage(ms(build_time) + " ms to build " + juce::String(NumDevices) + " device nodes, " + juce::String(NumConnected) + " with a GATT database");
+            logMessage(ms(publish_time) + " ms to publish them on the message thread");
+        }
+    }
+
+private:
+    static juce::String address(int i) { return juce::String::formatted("aa:bb:cc:dd:%02x:%02x", (i >> 8) & 0xff, i & 0xff); }
+
+    // Shaped like the nodes importManagedObjects() builds, a 31 byte advertisement and 4 services of 4 characteristics
+    // for connected devices
+    static juce::ValueTree makeDevice(int i, bool is_connected)
+    {
+        const uint8_t advertisement[31] = {0x02, 0x01, 0x06};
+
+        juce::ValueTree vt{ID::BLUETOOTH_DEVICE, {
+                                                         {ID::name, "Sensor " + juce::String(i)},
+                                                         {ID::address, address(i)},
+                                                         {ID::rssi, -60},
+                                                         {ID::is_connected, is_connected},
+                                                         {ID::last_seen, 0},
+                                                         {ID::advertisement, juce::MemoryBlock(advertisement, sizeof(advertisement))},
+                                                 },
+                           {}};
+
+        if (is_connected)
+        {
+            for (int s = 0; s < 4; ++s)
+            {
+                juce::ValueTree service{ID::SERVICE, {{ID::uuid, juce::Uuid().toDashedString()}}, {}};
+
+                for (int c = 0; c < 4; ++c)
+                    service.appendChild({ID::CHARACTERISTIC, {{ID::uuid, juce::Uuid().toDashedString()}}}, nullptr);
+
+                vt.appendChild(service, nullptr);
+            }
+        }
+
+        return vt;
+    }
+};
+
+static WarmStartTest warmStartTest;
+
+} // namespace genki
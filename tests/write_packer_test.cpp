@@ -0,0 +1,130 @@
+#include "juce_bluetooth/juce_bluetooth.h"
+
+#if JUCE_LINUX
+
+#include "native/linux/write_packer.h"
+
+namespace genki {
+
+class WritePackerTest : public juce::UnitTest
+{
+public:
+    WritePackerTest() : juce::UnitTest("WritePacker", "juce_bluetooth") {}
+
+    void runTest() override
+    {
+        using Result = WritePacker::Result;
+
+        beginTest("Messages are packed until the packet is full");
+        {
+            WritePacker                      packer;
+            std::vector<WritePacker::Packet> packets;
+
+            const auto emit = [&](auto&& packet) { packets.push_back(std::move(packet)); };
+
+            expect(packer.add(lengthPrefixed, "/char", bytes(4), 20, emit) == Result::Opened);
+
+            for (int i = 0; i < 3; ++i)
+                expect(packer.add(lengthPrefixed, "/char", bytes(4), 20, emit) == Result::Appended);
+
+            // Four 5 byte frames fill the packet exactly, it is closed right away
+            expectEquals(static_cast<int>(packets.size()), 1);
+            expectEquals(static_cast<int>(packets[0].data.size()), 20);
+            expect(!packer.isOpen());
+
+            expect(packer.add(lengthPrefixed, "/char", bytes(4), 20, emit) == Result::Opened);
+            expect(packer.add(lengthPrefixed, "/char", bytes(16), 20, emit) == Result::Opened);
+
+            expectEquals(static_cast<int>(packets.size()), 2);
+            expectEquals(static_cast<int>(packets[1].data.size()), 5);
+            expect(packer.isOpen());
+        }
+
+        beginTest("A write to another characteristic closes the open packet");
+        {
+            WritePacker                      packer;
+            std::vector<WritePacker::Packet> packets;
+
+            const auto emit = [&](auto&& packet) { packets.push_back(std::move(packet)); };
+
+            packer.add(lengthPrefixed, "/char1", bytes(2), 20, emit);
+            expect(packer.add(lengthPrefixed, "/char2", bytes(2), 20, emit) == Result::Opened);
+            packer.close(emit);
+
+            expectEquals(static_cast<int>(packets.size()), 2);
+            expect(packets[0].objectPath == "/char1");
+            expect(packets[1].objectPath == "/char2");
+        }
+
+        beginTest("A message that doesn't fit a packet is sent on its own");
+        {
+            WritePacker                      packer;
+            std::vector<WritePacker::Packet> packets;
+
+            const auto emit = [&](auto&& packet) { packets.push_back(std::move(packet)); };
+
+            packer.add(lengthPrefixed, "/char", bytes(2), 20, emit);
+            expect(packer.add(lengthPrefixed, "/char", bytes(24), 20, emit) == Result::Oversized);
+
+            expectEquals(static_cast<int>(packets.size()), 2);
+            expectEquals(static_cast<int>(packets[1].data.size()), 24);
+            expect(!packer.isOpen());
+        }
+
+        beginTest("Packing throughput");
+        {
+            // 8 byte messages into the 244 bytes a 247 byte ATT MTU leaves for a value
+            constexpr int    NumMessages = 1 << 20;
+            constexpr size_t MaxLength   = 244;
+
+            WritePacker packer;
+            const auto  message = bytes(8);
+
+            size_t num_packets = 0;
+            size_t num_bytes   = 0;
+
+            const auto emit = [&](auto&& packet)
+            {
+                ++num_packets;
+                num_bytes += packet.data.size();
+            };
+
+            const auto start = juce::Time::getHighResolutionTicks();
+
+            for (int i = 0; i < NumMessages; ++i)
+                packer.add(lengthPrefixed, "/org/bluez/hci0/dev_00_11_22_33_44_55/service0010/char0011", message, MaxLength, emit);
+
+            packer.close(emit);
+
+            const auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+
+            expectEquals(static_cast<int64_t>(num_bytes), static_cast<int64_t>(NumMessages) * 9);
+            expectEquals(static_cast<int64_t>(num_packets), static_cast<int64_t>((NumMessages + 26) / 27));
+
+            logMessage(juce::String(seconds * 1.0e9 / NumMessages, 1) + " ns per packed message, " + juce::String(static_cast<int64_t>(num_packets)) + " packets");
+        }
+    }
+
+private:
+    // One length byte in front of every message
+    static bool appendLengthPrefixed(std::vector<gsl::byte>& packet, gsl::span<const gsl::byte> message, size_t maxLength)
+    {
+        if (packet.size() + 1 + message.size() > maxLength)
+            return false;
+
+        packet.push_back(static_cast<gsl::byte>(message.size()));
+        packet.insert(packet.end(), message.begin(), message.end());
+
+        return true;
+    }
+
+    static std::vector<gsl::byte> bytes(size_t length) { return std::vector<gsl::byte>(length, gsl::byte{0x2a}); }
+
+    const WritePacker::Append lengthPrefixed = &WritePackerTest::appendLengthPrefixed;
+};
+
+static WritePackerTest writePackerTest;
+
+} // namespace genki
+
+#endif